@@ -0,0 +1,216 @@
+#include "AllocTracker.h"
+
+#ifdef CSK_ALLOC_TRACKING
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+
+// glibc's real allocator entry points, so the interposed functions below can
+// forward without recursing into themselves
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void __libc_free(void *pointer);
+}
+
+namespace {
+
+const int MAX_TAGS = 32;  // Tag 0 is "untagged"
+
+struct TagCounters {
+    const char *name;
+    std::atomic<unsigned long> allocations;
+    std::atomic<unsigned long> bytes;
+    unsigned long warmupAllocations;  // Snapshot when the warmup ended
+    unsigned long warmupBytes;
+};
+
+TagCounters tags[MAX_TAGS];
+std::atomic<int> tagCount(1);  // Names below it are final; registration is serialized by tagMutex
+std::mutex tagMutex;
+std::atomic<unsigned long> events(0);
+unsigned long warmupEvents = 50;
+thread_local int currentTag = 0;
+
+void countAllocation(size_t size) {
+    TagCounters &tag = tags[currentTag];
+    tag.allocations.fetch_add(1, std::memory_order_relaxed);
+    tag.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+struct ReportAtExit {
+    ReportAtExit() { tags[0].name = "untagged"; }
+    ~ReportAtExit() { allocTrackerReport(); }
+} reportAtExit;
+
+}
+
+AllocScope::AllocScope(int tag) : previous(currentTag) {
+    currentTag = tag;
+}
+
+AllocScope::~AllocScope() {
+    currentTag = previous;
+}
+
+static int findTag(const char *name, int from, int count) {
+    for (int i = from; i < count; i++) {
+        if (std::strcmp(tags[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+int allocTagIndex(const char *name) {
+    // Called once per call site (function-local static), so a linear scan is fine.
+    // Sites with the same name can run first on different threads (capture and
+    // the sink threads), so a new name is added under the lock.
+    int count = tagCount.load(std::memory_order_acquire);
+    if (int index = findTag(name, 1, count)) {
+        return index;
+    }
+
+    std::lock_guard<std::mutex> lock(tagMutex);
+    int current = tagCount.load(std::memory_order_relaxed);
+    if (int index = findTag(name, count, current)) {
+        return index;  // Registered by another thread since the scan above
+    }
+    if (current == MAX_TAGS) {
+        return 0;
+    }
+    tags[current].name = name;
+    tagCount.store(current + 1, std::memory_order_release);
+    return current;
+}
+
+void allocTrackerSetWarmup(unsigned long count) {
+    warmupEvents = count;
+}
+
+static void snapshotWarmup() {
+    for (int i = 0; i < tagCount.load(); i++) {
+        tags[i].warmupAllocations = tags[i].allocations.load(std::memory_order_relaxed);
+        tags[i].warmupBytes = tags[i].bytes.load(std::memory_order_relaxed);
+    }
+}
+
+void allocTrackerEvent() {
+    if (events.fetch_add(1, std::memory_order_relaxed) + 1 == warmupEvents) {
+        snapshotWarmup();
+    }
+}
+
+void allocTrackerStartSteadyState() {
+    snapshotWarmup();
+    warmupEvents = 0;
+    events.store(0, std::memory_order_relaxed);
+}
+
+static unsigned long steadyEvents() {
+    unsigned long count = events.load(std::memory_order_relaxed);
+    return count > warmupEvents ? count - warmupEvents : 0;
+}
+
+double allocTrackerAllocsPerEvent() {
+    unsigned long count = steadyEvents();
+    if (count == 0) {
+        return 0;
+    }
+    unsigned long allocations = 0;
+    for (int i = 0; i < tagCount.load(); i++) {
+        allocations += tags[i].allocations.load(std::memory_order_relaxed) - tags[i].warmupAllocations;
+    }
+    return double(allocations) / count;
+}
+
+void allocTrackerReport() {
+    unsigned long count = steadyEvents();
+    std::fprintf(stderr, "Allocation tracking: %lu events after %lu warmup events\n",
+                 count, warmupEvents);
+    if (count == 0) {
+        return;
+    }
+
+    std::fprintf(stderr, "  %-24s %14s %14s\n", "stage", "allocs/event", "bytes/event");
+    double totalAllocations = 0, totalBytes = 0;
+    for (int i = 0; i < tagCount.load(); i++) {
+        double allocations = double(tags[i].allocations.load() - tags[i].warmupAllocations) / count;
+        double bytes = double(tags[i].bytes.load() - tags[i].warmupBytes) / count;
+        totalAllocations += allocations;
+        totalBytes += bytes;
+        if (allocations > 0) {
+            std::fprintf(stderr, "  %-24s %14.2f %14.1f\n", tags[i].name, allocations, bytes);
+        }
+    }
+    std::fprintf(stderr, "  %-24s %14.2f %14.1f\n", "total", totalAllocations, totalBytes);
+}
+
+extern "C" {
+
+void *malloc(size_t size) {
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    countAllocation(size);
+    return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) {
+    __libc_free(pointer);
+}
+
+}
+
+void *operator new(size_t size) {
+    countAllocation(size);
+    void *pointer = __libc_malloc(size ? size : 1);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    countAllocation(size);
+    return __libc_malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *pointer) noexcept {
+    __libc_free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    __libc_free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    __libc_free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept {
+    __libc_free(pointer);
+}
+
+#endif
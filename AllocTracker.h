@@ -0,0 +1,53 @@
+#ifndef ALLOCTRACKER_H
+#define ALLOCTRACKER_H
+
+// Allocation tracking build mode. Compile every file with -DCSK_ALLOC_TRACKING
+// and link AllocTracker.cpp: operator new/delete and malloc/calloc/realloc are
+// then interposed and each allocation is charged to the innermost
+// CSK_ALLOC_SCOPE() on the allocating thread. Allocations and bytes per event
+// (CSK_ALLOC_EVENT() marks one) are printed at exit. In normal builds the
+// macros expand to nothing.
+
+#ifdef CSK_ALLOC_TRACKING
+
+class AllocScope {
+public:
+    explicit AllocScope(int tag);
+    ~AllocScope();
+
+private:
+    int previous;
+};
+
+// Returns the index of a stage name, registering it on first use
+int allocTagIndex(const char *name);
+
+// Counts one input event; the first `warmup` events are left out of the rates
+void allocTrackerEvent();
+
+// Steady-state allocations per event over all stages
+double allocTrackerAllocsPerEvent();
+
+// Prints the per-stage table to stderr
+void allocTrackerReport();
+
+void allocTrackerSetWarmup(unsigned long events);
+
+// Ends the warmup now: counts so far are left out and the event count restarts
+void allocTrackerStartSteadyState();
+
+#define CSK_ALLOC_CONCAT2(a, b) a##b
+#define CSK_ALLOC_CONCAT(a, b) CSK_ALLOC_CONCAT2(a, b)
+#define CSK_ALLOC_SCOPE(name) \
+    static const int CSK_ALLOC_CONCAT(allocTag, __LINE__) = allocTagIndex(name); \
+    AllocScope CSK_ALLOC_CONCAT(allocScope, __LINE__)(CSK_ALLOC_CONCAT(allocTag, __LINE__))
+#define CSK_ALLOC_EVENT() allocTrackerEvent()
+
+#else
+
+#define CSK_ALLOC_SCOPE(name) ((void)0)
+#define CSK_ALLOC_EVENT() ((void)0)
+
+#endif
+
+#endif
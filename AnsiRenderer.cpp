@@ -0,0 +1,238 @@
+#include "AnsiRenderer.h"
+#include "TextWidth.h"
+#include "Trace.h"
+
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+static volatile sig_atomic_t resized = 1;  // Set by SIGWINCH; the size is read on the next frame
+
+static const char SYNC_BEGIN[] = "\x1b[?2026h";
+static const char SYNC_END[] = "\x1b[?2026l";
+
+bool AnsiRenderer::open(int outputFd, int inputFd) {
+    output = outputFd;
+    input = inputFd;
+
+    // Keys are read one at a time without echo; Ctrl+C still raises SIGINT
+    if (input >= 0 && isatty(input) && tcgetattr(input, &savedTermios) == 0) {
+        termiosSaved = true;
+        termios raw = savedTermios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(input, TCSANOW, &raw);
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = [](int) { resized = 1; };
+    sigaction(SIGWINCH, &action, nullptr);
+
+    syncOutput = termiosSaved && querySynchronizedOutput();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    updateSize();  // SIGWINCH only tells about changes after this
+    length = 0;
+    append("\x1b[?1049h\x1b[?25l");  // Alternate screen, hidden cursor
+    flush();
+    fullRedraw = true;
+    draw("");
+    return true;
+}
+
+void AnsiRenderer::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (output < 0) {
+        return;
+    }
+    length = 0;
+    append("\x1b[0m\x1b[?25h\x1b[?1049l");
+    flush();
+    if (termiosSaved) {
+        tcsetattr(input, TCSANOW, &savedTermios);
+        termiosSaved = false;
+    }
+    output = -1;
+    input = -1;
+}
+
+// Asks for the state of mode 2026 (DECRQM); supporting terminals answer
+// "ESC [ ? 2026 ; N $ y" with N 1 or 2, others stay silent
+bool AnsiRenderer::querySynchronizedOutput() {
+    static const char query[] = "\x1b[?2026$p";
+    if (write(output, query, sizeof(query) - 1) != sizeof(query) - 1) {
+        return false;
+    }
+
+    std::string reply;
+    auto deadline = traceNowNs() + 200000000ULL;
+    while (reply.find('y') == std::string::npos && reply.size() < 64) {
+        uint64_t now = traceNowNs();
+        pollfd fd = {input, POLLIN, 0};
+        if (now >= deadline || poll(&fd, 1, static_cast<int>((deadline - now) / 1000000) + 1) <= 0) {
+            return false;
+        }
+        char buffer[32];
+        ssize_t n = read(input, buffer, sizeof(buffer));
+        if (n <= 0) {
+            return false;
+        }
+        reply.append(buffer, n);
+    }
+
+    size_t answer = reply.find("\x1b[?2026;");
+    if (answer == std::string::npos || answer + 8 >= reply.size()) {
+        return false;
+    }
+    char state = reply[answer + 8];
+    return state == '1' || state == '2';
+}
+
+void AnsiRenderer::updateSize() {
+    winsize size;
+    if (ioctl(output, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+        rows = size.ws_row;
+        columns = size.ws_col;
+    }
+}
+
+void AnsiRenderer::append(const char *data, size_t size) {
+    // The closing sequences always fit; text past the buffer is cut
+    size_t room = FRAME_CAPACITY - sizeof(SYNC_END) - length;
+    if (size > room) {
+        size = room;
+    }
+    std::memcpy(frame + length, data, size);
+    length += size;
+}
+
+void AnsiRenderer::append(const char *text) {
+    append(text, std::strlen(text));
+}
+
+void AnsiRenderer::appendNumber(int value) {
+    char digits[12];
+    int count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    char ordered[12];
+    for (int i = 0; i < count; i++) {
+        ordered[i] = digits[count - 1 - i];
+    }
+    append(ordered, count);
+}
+
+// CUP is 1-based
+void AnsiRenderer::moveTo(int row, int column) {
+    append("\x1b[");
+    appendNumber(row + 1);
+    append(";");
+    appendNumber(column + 1);
+    append("H");
+}
+
+void AnsiRenderer::appendColors() {
+    append("\x1b[0;3");
+    appendNumber(foreground);
+    append(";4");
+    appendNumber(background);
+    append("m");
+}
+
+void AnsiRenderer::setColors(short newForeground, short newBackground) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (newForeground == foreground && newBackground == background) {
+        return;
+    }
+    foreground = newForeground;
+    background = newBackground;
+    fullRedraw = true;
+    draw(lastText);
+}
+
+void AnsiRenderer::render(const std::string &text) {
+    std::lock_guard<std::mutex> lock(mutex);
+    draw(text);
+}
+
+void AnsiRenderer::draw(const std::string &text) {
+    CSK_TRACE_SCOPE("ansiRender");
+    if (output < 0) {
+        return;
+    }
+    if (resized) {
+        resized = 0;
+        updateSize();
+        fullRedraw = true;
+    }
+
+    length = 0;
+    if (syncOutput) {
+        append(SYNC_BEGIN, sizeof(SYNC_BEGIN) - 1);
+    }
+    if (fullRedraw) {
+        appendColors();
+        append("\x1b[2J");  // Erases with the background color just set
+        fullRedraw = false;
+    } else if (shownRow >= 0) {
+        moveTo(shownRow, 0);
+        append("\x1b[2K");  // Only the previous text's line is erased
+    }
+    shownRow = -1;
+
+    if (!text.empty()) {
+        int row = rows / 2;
+        int textWidth = textColumns(text);
+        if (textWidth <= columns) {
+            moveTo(row, (columns - textWidth) / 2);
+            append(text.data(), text.size());
+        } else {
+            std::string shown = truncateText(text, columns, textWidth);
+            moveTo(row, 0);
+            append(shown.data(), shown.size());
+        }
+        shownRow = row;
+    }
+
+    if (syncOutput) {
+        std::memcpy(frame + length, SYNC_END, sizeof(SYNC_END) - 1);
+        length += sizeof(SYNC_END) - 1;
+    }
+    flush();
+    lastText = text;
+    frameCount++;
+}
+
+void AnsiRenderer::flush() {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = write(output, frame + sent, length - sent);
+        writeCount++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;  // Terminal gone; the frame is dropped
+        }
+        sent += n;
+        byteCount += n;
+    }
+    length = 0;
+}
+
+int AnsiRenderer::readKey() {
+    // Only a terminal was switched to non-blocking reads; a pipe or FIFO on
+    // stdin would block the render loop, so check for input first
+    pollfd ready = {input, POLLIN, 0};
+    unsigned char key;
+    if (input < 0 || poll(&ready, 1, 0) <= 0 || read(input, &key, 1) != 1) {
+        return -1;
+    }
+    return key;
+}
@@ -0,0 +1,72 @@
+#ifndef ANSIRENDERER_H
+#define ANSIRENDERER_H
+
+#include <string>
+#include <mutex>
+#include <termios.h>
+
+// Terminal view without ncurses: every frame is composed into a preallocated
+// buffer of cursor moves, erases and SGR color sequences and sent with one
+// write(). Only the line that changed is redrawn. Terminals that answer the
+// DECRQM query for mode 2026 get each frame wrapped in synchronized-update
+// mode, so they never show a half-drawn frame.
+class AnsiRenderer {
+public:
+    static const size_t FRAME_CAPACITY = 16384;
+
+    AnsiRenderer() = default;
+    ~AnsiRenderer() { close(); }
+
+    AnsiRenderer(const AnsiRenderer &) = delete;
+    AnsiRenderer &operator=(const AnsiRenderer &) = delete;
+
+    // Takes over the terminal on `outputFd`: alternate screen, hidden cursor,
+    // no echo. `inputFd` answers the synchronized-output query; -1 skips it.
+    bool open(int outputFd, int inputFd);
+    void close();
+
+    // ncurses color numbers (0 black .. 7 white); safe to call from any thread
+    void setColors(short foreground, short background);
+    void setSynchronizedOutput(bool enabled) { syncOutput = enabled; }
+    bool synchronizedOutput() const { return syncOutput; }
+
+    // Draws `text` centered on the middle line; "" clears it. Safe to call from any thread.
+    void render(const std::string &text);
+
+    // A key typed in the terminal, -1 when none; never blocks
+    int readKey();
+
+    unsigned long frames() const { return frameCount; }
+    unsigned long writeCalls() const { return writeCount; }
+    unsigned long long bytesWritten() const { return byteCount; }
+
+private:
+    void draw(const std::string &text);
+    void append(const char *data, size_t size);
+    void append(const char *text);
+    void appendNumber(int value);
+    void moveTo(int row, int column);
+    void appendColors();
+    bool querySynchronizedOutput();
+    void updateSize();
+    void flush();
+
+    std::mutex mutex;  // Guards the frame buffer and the screen state below
+    int output = -1;
+    int input = -1;
+    termios savedTermios;
+    bool termiosSaved = false;
+    char frame[FRAME_CAPACITY];  // Reused for every frame
+    size_t length = 0;
+    std::string lastText;  // Redrawn when the colors change
+    int rows = 24, columns = 80;
+    int shownRow = -1;  // Line holding the previous frame's text, -1 when blank
+    bool fullRedraw = true;
+    bool syncOutput = false;
+    short foreground = 7, background = 0;
+    unsigned long frameCount = 0;
+    unsigned long writeCount = 0;
+    unsigned long long byteCount = 0;
+};
+
+#endif
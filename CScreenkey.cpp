@@ -2,135 +2,43 @@
 #include <thread>
 #include <string>
 #include <vector>
-#include <mutex>
-#include <map>
-#include <set>
 #include <ncurses.h>  // ncurses for lightweight terminal-based UI
-#include <cstdlib>    // for system()
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <clocale>
+#include <atomic>
 
 #ifdef _WIN32
     #include <windows.h>
 #elif __linux__
-    #include <X11/Xlib.h>
-    #include <X11/XKBlib.h>
-    #include <X11/keysym.h>
-    #include <X11/extensions/XInput2.h>
+    #include <poll.h>
+    #include <unistd.h>
+    #include <csignal>
+    #include "ScreenKey.h"
+    #include "EventServer.h"
+    #include "ShmRing.h"
+    #include "SubtitleWriter.h"
+    #include "Config.h"
+    #include "ControlServer.h"
+    #include "AnsiRenderer.h"
+    #include "SnapshotHub.h"
+    #include <ctime>
+    #include <fcntl.h>
+    #include <sstream>
 #endif
 
-std::mutex output_mutex;
-std::set<std::string> activeKeys;
-std::map<int, std::string> specialKeyMap;
-bool quit = false;
-bool updated = false;
-
-void initNcurses() {
-    initscr();  // Initialize the ncurses screen
-    cbreak();   // Disable line buffering
-    noecho();   // Disable echoing of typed characters
-    curs_set(0);  // Hide the cursor
-    timeout(0);  // Non-blocking input
-    start_color();  // Enable colors if the terminal supports it
-    init_pair(1, COLOR_WHITE, COLOR_BLACK);  // Define text color
+#include "KeyState.h"
+#include "NcursesRenderer.h"
+#include "AllocTracker.h"
+#include "Trace.h"
 
-#ifdef __linux__
-    // Command to make the terminal always on top using wmctrl (Linux only)
-    system("wmctrl -r :ACTIVE: -b add,above");
-#elif _WIN32
-    // Make console window always on top in Windows
-    SetWindowPos(GetConsoleWindow(), HWND_TOPMOST, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE);
-#endif
-}
-
-void renderText(const std::string& inputText) {
-    std::lock_guard<std::mutex> lock(output_mutex);
-
-    clear();  // Clear the screen
-    attron(COLOR_PAIR(1));  // Set the color
-
-    int term_width, term_height;
-    getmaxyx(stdscr, term_height, term_width);  // Get the terminal size
-
-    // Calculate the centered position for the text
-    int text_length = inputText.length();
-    int start_x = (term_width - text_length) / 2;
-    int start_y = term_height / 2;
-
-    // Print the text at the center of the screen
-    mvprintw(start_y, start_x, inputText.c_str());
-
-    refresh();  // Refresh the screen to show changes
-}
-
-void initializeKeyMappings() {
-    specialKeyMap[XK_apostrophe] = "APOSTROPHE (')";
-    specialKeyMap[XK_slash] = "SLASH (/)";
-    specialKeyMap[XK_backslash] = "BACKSLASH (\\)";
-    specialKeyMap[XK_Left] = "ARROW LEFT";
-    specialKeyMap[XK_Right] = "ARROW RIGHT";
-    specialKeyMap[XK_Up] = "ARROW UP";
-    specialKeyMap[XK_Down] = "ARROW DOWN";
-    specialKeyMap[XK_KP_Divide] = "KP_DIVIDE (/)";
-    specialKeyMap[XK_KP_Multiply] = "KP_MULTIPLY (*)";
-    specialKeyMap[XK_KP_Subtract ] = "KP_SUBTRACT (-)";
-    specialKeyMap[XK_KP_Add] = "KP_ADD (+)";
-    specialKeyMap[XK_bracketleft] = "BRACKETLEFT ([)";
-    specialKeyMap[XK_bracketright] = "BRACKETRIGHT (])";
-    specialKeyMap[XK_comma] = "COMMA (,)";
-    specialKeyMap[XK_period] = "PERIOD (.)";
-    specialKeyMap[XK_dead_acute] = "DEAD_ACUTE (´)";
-    specialKeyMap[XK_dead_tilde] = "DEAD_TILDE (~)";
-    specialKeyMap[XK_dead_cedilla] = "DEAD_CEDILLA (Ç)";
-    specialKeyMap[XK_minus] = "EQUAL (-)";
-    specialKeyMap[XK_equal] = "EQUAL (=)";
-    specialKeyMap[XK_semicolon] = "SEMICOLON (;)";
-    specialKeyMap[XK_Page_Up] = "PAGE UP";
-    specialKeyMap[XK_Page_Down] = "PAGE DOWN";
-    specialKeyMap[XK_Home] = "HOME";
-    specialKeyMap[XK_End] = "END";
-    specialKeyMap[1] = "MOUSE LEFT CLICK";
-    specialKeyMap[2] = "MOUSE MIDDLE CLICK";  // Fixed middle-click support
-    specialKeyMap[3] = "MOUSE RIGHT CLICK";
-    specialKeyMap[4] = "MOUSE SCROLL UP";
-    specialKeyMap[5] = "MOUSE SCROLL DOWN";
-}
-
-void showPressedKey(const std::string &combination) {
-    std::string uppercase_combination;
-    for (char c : combination) {
-        uppercase_combination += std::toupper(c);
-    }
-    renderText(uppercase_combination);  // Display the keypress or mouse event
-}
-
-void updateKeyCombination() {
-    if (!activeKeys.empty()) {
-        std::string combination;
-        for (const auto& key : activeKeys) {
-            if (!combination.empty()) {
-                combination += " + ";
-            }
-            combination += key;
-        }
-        showPressedKey(combination);
-    }
-    updated = true;
-}
-
-void addSpecialKey(const std::string &keyStr) {
-    activeKeys.insert(keyStr);
-    updateKeyCombination();
-}
-
-void removeSpecialKey(const std::string &keyStr) {
-    activeKeys.erase(keyStr);
-    updateKeyCombination();
-}
-
-void clearActiveKeys() {
-    activeKeys.clear();
-}
+std::atomic<bool> quit{false};  // Also set by the control socket's quit command on the capture thread
+std::string tracePath;  // Spans are only recorded when --trace is given
 
 #ifdef _WIN32
+KeyState windowsKeys;  // Low-level hooks carry no user pointer, so their state is global here
+
 LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) {
     if (nCode == HC_ACTION) {
         KBDLLHOOKSTRUCT *kbdStruct = (KBDLLHOOKSTRUCT *)lParam;
@@ -139,11 +47,11 @@ LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) {
         std::string keyStr(key);
 
         if (wParam == WM_KEYDOWN) {
-            activeKeys.insert(keyStr);
-            updateKeyCombination();
+            windowsKeys.add(keyStr);
+            windowsKeys.emit(KEY_EVENT_PRESS, kbdStruct->vkCode, keyStr, kbdStruct->time);
         } else if (wParam == WM_KEYUP) {
-            activeKeys.erase(keyStr);
-            updateKeyCombination();
+            windowsKeys.remove(keyStr);
+            windowsKeys.emit(KEY_EVENT_RELEASE, kbdStruct->vkCode, keyStr, kbdStruct->time);
         }
     }
     return CallNextHookEx(nullptr, nCode, wParam, lParam);
@@ -165,19 +73,25 @@ LRESULT CALLBACK LowLevelMouseProc(int nCode, WPARAM wParam, LPARAM lParam) {
         }
 
         if (!buttonStr.empty()) {
-            activeKeys.insert(buttonStr);
-            updateKeyCombination();
+            windowsKeys.add(buttonStr);
+            windowsKeys.emit(KEY_EVENT_BUTTON_PRESS, 0, buttonStr, mouseStruct->time);
         }
 
         if (wParam == WM_LBUTTONUP || wParam == WM_MBUTTONUP || wParam == WM_RBUTTONUP) {
-            activeKeys.erase(buttonStr);
-            updateKeyCombination();
+            windowsKeys.remove(buttonStr);
+            windowsKeys.emit(KEY_EVENT_BUTTON_RELEASE, 0, buttonStr, mouseStruct->time);
         }
     }
     return CallNextHookEx(nullptr, nCode, wParam, lParam);
 }
 
 void startWindowsScreenKey() {
+    windowsKeys.setListener([](const KeyEvent &) {
+        if (!windowsKeys.empty()) {
+            showPressedKey(windowsKeys.combination());
+        }
+    });
+
     HHOOK keyboardHook = SetWindowsHookEx(WH_KEYBOARD_LL, LowLevelKeyboardProc, nullptr, 0);
     HHOOK mouseHook = SetWindowsHookEx(WH_MOUSE_LL, LowLevelMouseProc, nullptr, 0);
 
@@ -193,129 +107,648 @@ void startWindowsScreenKey() {
 #endif
 
 #ifdef __linux__
-Display *display;
-
-void handleLinuxKeyPress(XIDeviceEvent *xide) {
-    KeySym keysym = XkbKeycodeToKeysym(display, xide->detail, 0, 0);
-    std::string keyStr;
-
-    // Check for special key mapping
-    if (specialKeyMap.count(keysym)) {
-        keyStr = specialKeyMap[keysym];
+std::vector<const char *> displayNames;  // From --display; empty means $DISPLAY
+std::vector<ScreenKey *> screenKeys;  // One capture instance per display
+std::string sequencesPath;
+std::string profilesPath;
+unsigned long sequenceTimeoutMs = 1000;
+std::string composePath;  // --compose; empty means the user's or the locale's Compose file
+bool composeEnabled = true;  // --no-compose clears it
+ComposeTable composeTable;  // Shared by every display
+int resyncIntervalMs = 2000;
+bool deviceLabels = false;  // --device-labels: prefix chords with the device that typed them
+bool perDeviceState = false;  // --per-device
+std::vector<std::string> privacyRules;  // --private, joined by the config file's rules
+int dragThreshold = 8;
+KeyStats *keyStats = nullptr;  // Only allocated when --stats is given
+EventServer *eventServer = nullptr;  // Only allocated when --listen or --listen-tcp is given
+ShmPublisher *shmPublisher = nullptr;  // Only allocated when --shm is given
+SubtitleWriter *subtitleWriter = nullptr;  // Only allocated when --subtitles is given
+unsigned long subtitleLingerMs = 1500;
+std::string statsPath;
+volatile sig_atomic_t statsRequested = 0;  // Set by SIGUSR1
+volatile sig_atomic_t traceRequested = 0;  // Set by SIGUSR2
+std::string configPath;  // --config, else ~/.config/cscreenkey.conf when it exists
+ConfigStore configStore;
+unsigned long appliedConfig = 0;  // Generation of the Config the capture thread applied last
+bool daemonMode = false;  // --daemon: detached, no terminal, controlled through the socket
+std::string controlPath;  // --control; --daemon alone uses defaultControlPath()
+ControlServer *controlServer = nullptr;
+volatile sig_atomic_t stopRequested = 0;  // Set by SIGTERM and SIGINT
+
+// Owned by the capture thread, changed by control commands and the Config
+enum Renderer { RENDERER_NONE, RENDERER_NCURSES, RENDERER_ANSI };
+const char *const rendererNames[] = {"none", "ncurses", "ansi"};
+Renderer terminalRenderer = RENDERER_NCURSES;  // Set up in main(); switching between ncurses and ansi needs a restart
+std::atomic<Renderer> renderer(RENDERER_NCURSES);  // Also read by the terminal sink's thread
+std::string rendererName;  // --renderer, else the Config's
+bool rendererExplicit = false;  // Set by --renderer or a control command; the Config no longer switches it
+std::string configRenderer;  // The Config's renderer as last applied, so only a change to it switches
+std::vector<std::pair<unsigned long, std::string>> configLabels;  // Labels last applied; rebuilding the table is an XKB round trip
+AnsiRenderer ansiRenderer;
+bool paused = false;  // Events are still read, so the pressed state stays right, but not shown, published or counted
+
+// Every shown combination is published to the display sinks, each drawing or
+// writing on its own thread at its own pace
+SnapshotHub displayHub;
+int terminalSink = -1;  // Index in displayHub, paced by frame-cap; -1 without a terminal
+std::FILE *logFile = nullptr;  // --log: every shown combination, one line each
+
+// Display timing, owned by the capture thread and set from the Config
+int frameIntervalMs = 1000 / 30;  // Terminal redraws at most this often; 0 draws as soon as it can
+unsigned long lingerMs = 0;  // 0 keeps the last keys on screen
+bool lingering = false;  // Every key is released and the screen clears after lingerMs
+std::chrono::steady_clock::time_point releasedAt;
+
+// Terminal sink: uppercases and draws the snapshot, or clears the view once the renderer is none
+void drawSnapshot(const Snapshot &snapshot) {
+    static const std::string blank;
+    static bool shown = false;  // Only touched on the terminal sink's thread
+    bool visible = renderer != RENDERER_NONE;
+    if (!visible && !shown) {
+        return;
+    }
+    const std::string &text = visible ? snapshot.text : blank;
+    if (terminalRenderer == RENDERER_ANSI) {
+        ansiRenderer.render(toUppercase(text));
     } else {
-        keyStr = XKeysymToString(keysym);
+        showPressedKey(text);
     }
+    shown = !text.empty();
+}
 
-    if (!keyStr.empty()) {
-        activeKeys.insert(keyStr);
-        updateKeyCombination();
+// Log sink: one "YYYY-MM-DD HH:MM:SS.mmm  KEYS" line per shown combination
+void logSnapshot(const Snapshot &snapshot) {
+    if (snapshot.text.empty()) {
+        return;
     }
+    std::time_t seconds = std::chrono::system_clock::to_time_t(snapshot.time);
+    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+        snapshot.time.time_since_epoch()).count() % 1000;
+    std::tm local;
+    localtime_r(&seconds, &local);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+    std::fprintf(logFile, "%s.%03d  %s\n", stamp, static_cast<int>(milliseconds), toUppercase(snapshot.text).c_str());
+    std::fflush(logFile);
 }
 
-void handleLinuxKeyRelease(XIDeviceEvent *xide) {
-    KeySym keysym = XkbKeycodeToKeysym(display, xide->detail, 0, 0);
-    std::string keyStr;
+// Clears a lingering combination when due; returns the ms until then
+int updateDisplay() {
+    int timeout = 100;
+    if (lingering && lingerMs > 0) {
+        auto now = std::chrono::steady_clock::now();
+        auto due = releasedAt + std::chrono::milliseconds(lingerMs);
+        if (now >= due) {
+            lingering = false;
+            displayHub.publish("");
+        } else {
+            timeout = std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count() + 1;
+        }
+    }
+    return timeout;
+}
 
-    if (specialKeyMap.count(keysym)) {
-        keyStr = specialKeyMap[keysym];
+bool setRenderer(const std::string &name, std::string &error) {
+    if (name == "none") {
+        renderer = RENDERER_NONE;
+        displayHub.publish("");  // The terminal sink clears the view
+    } else if ((name == "ncurses" || name == "ansi") && daemonMode) {
+        error = "no terminal in daemon mode";
+        return false;
+    } else if (name == rendererNames[terminalRenderer]) {
+        renderer = terminalRenderer;
+    } else if (name == "ncurses" || name == "ansi") {
+        error = "restart to switch between ncurses and ansi";
+        return false;
     } else {
-        keyStr = XKeysymToString(keysym);
+        error = "unknown renderer '" + name + "'";
+        return false;
     }
+    return true;
+}
 
-    if (!keyStr.empty()) {
-        activeKeys.erase(keyStr);
-        updateKeyCombination();
+// Applies a newly published Config; runs on the capture thread between events
+void applyConfig(const Config &config) {
+    appliedConfig = config.generation;
+    std::string error;
+    if (config.renderer != configRenderer) {
+        configRenderer = config.renderer;
+        if (!daemonMode && !rendererExplicit && !config.renderer.empty() && !setRenderer(config.renderer, error)) {
+            std::cerr << "Config: " << error << std::endl;
+        }
+    }
+    frameIntervalMs = config.frameCap > 0 ? 1000 / config.frameCap : 0;
+    if (terminalSink >= 0) {
+        displayHub.setInterval(terminalSink, frameIntervalMs);
+    }
+    lingerMs = config.lingerMs;
+    if (!daemonMode) {  // No terminal; ncurses was never initialized
+        if (terminalRenderer == RENDERER_ANSI) {
+            ansiRenderer.setColors(config.foreground, config.background);
+        } else {
+            setColors(config.foreground, config.background);
+        }
+    }
+    std::vector<std::string> rules = privacyRules;
+    rules.insert(rules.end(), config.privacyRules.begin(), config.privacyRules.end());
+    bool labelsChanged = config.labels != configLabels;
+    if (labelsChanged) {
+        configLabels = config.labels;
+    }
+    for (ScreenKey *screenKey : screenKeys) {
+        if (labelsChanged) {
+            screenKey->setLabels(config.labels);
+        }
+        screenKey->setPrivacyRules(rules);
     }
 }
 
-void handleLinuxButtonPress(XIDeviceEvent *xide) {
-    std::string buttonStr;
-
-    if (specialKeyMap.count(xide->detail)) {
-        buttonStr = specialKeyMap[xide->detail];
-    } else {
-        buttonStr = "Unknown Mouse Button";
+// Displays the event and hands it to every subscriber
+void handleKeyEvent(const ScreenKey &screenKey, const KeyEvent &event) {
+    if (paused) {
+        return;
+    }
+    if (event.combination[0]) {
+        CSK_ALLOC_SCOPE("showPressedKey");
+        if (screenKeys.size() > 1 || (deviceLabels && event.device[0])) {
+            // Say where the shown keys come from
+            std::string text;
+            if (screenKeys.size() > 1) {
+                text = std::string(event.source) + "  ";
+            }
+            if (deviceLabels && event.device[0]) {
+                text += std::string("[") + event.device + "] ";
+            }
+            displayHub.publish(text + screenKey.combination());
+        } else {
+            displayHub.publish(screenKey.combination());
+        }
+        lingering = false;
+    } else if (!lingering) {
+        lingering = true;
+        releasedAt = std::chrono::steady_clock::now();
     }
 
-    if (!buttonStr.empty()) {
-        activeKeys.insert(buttonStr);
-        updateKeyCombination();
+    CSK_ALLOC_SCOPE("sinks");
+    CSK_TRACE_SCOPE("sinks");
+    if (subtitleWriter) {
+        // X server times of different displays count from different epochs; one local clock keeps cues in order
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        subtitleWriter->show(toUppercase(event.combination), static_cast<unsigned long>(now));
+    }
+    if (eventServer) {
+        eventServer->publish(event);
+    }
+    if (shmPublisher) {
+        shmPublisher->publish(event, screenKey.pressedKeymap());
     }
 }
 
-void handleLinuxButtonRelease(XIDeviceEvent *xide) {
-    std::string buttonStr;
+// Runs one control socket command on the capture thread and returns the reply line
+std::string handleControlCommand(const std::string &command) {
+    std::istringstream words(command);
+    std::string verb, argument;
+    words >> verb >> argument;
 
-    if (specialKeyMap.count(xide->detail)) {
-        buttonStr = specialKeyMap[xide->detail];
-    } else {
-        buttonStr = "Unknown Mouse Button";
+    if (verb == "pause" || verb == "resume") {
+        paused = verb == "pause";
+        if (paused) {
+            displayHub.publish("");
+        }
+        for (ScreenKey *screenKey : screenKeys) {
+            screenKey->setStats(paused ? nullptr : keyStats);  // Keys typed while paused aren't counted either
+        }
+        return "ok";
+    } else if (verb == "renderer") {
+        std::string error;
+        if (!setRenderer(argument, error)) {
+            return "error: " + error;
+        }
+        rendererExplicit = true;
+        return "ok";
+    } else if (verb == "clear") {
+        // Forgets stuck keys; the next resync adds back the ones really held
+        for (ScreenKey *screenKey : screenKeys) {
+            screenKey->clear();
+        }
+        lingering = false;
+        displayHub.publish("");
+        return "ok";
+    } else if (verb == "stats") {
+        if (!keyStats) {
+            return "error: statistics are off, start with --stats FILE";
+        }
+        statsRequested = 1;  // Written by the main thread, file I/O stays off the capture thread
+        return "ok writing " + statsPath;
+    } else if (verb == "reload") {
+        return configStore.requestReload() ? "ok" : "error: no config file";
+    } else if (verb == "status") {
+        return std::string("ok ") + (paused ? "paused" : "running") +
+               " renderer=" + rendererNames[renderer] +
+               " displays=" + std::to_string(screenKeys.size()) +
+               " config=" + (configPath.empty() ? "none" : configPath);
+    } else if (verb == "quit") {
+        quit = true;
+        return "ok";
     }
+    return "error: unknown command '" + verb + "' (pause, resume, renderer NAME, clear, stats, reload, status, quit)";
+}
 
-    if (!buttonStr.empty()) {
-        activeKeys.erase(buttonStr);
-        updateKeyCombination();
+// Detaches from the terminal; the parent prints the daemon's pid and exits
+bool daemonize() {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid > 0) {
+        std::cerr << "Running in the background as pid " << pid << ", control socket " << controlPath << std::endl;
+        _exit(0);  // Skips destructors, which would remove the child's sockets
     }
+
+    setsid();
+    int null = open("/dev/null", O_RDWR);
+    if (null >= 0) {
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        if (null > STDERR_FILENO) {
+            close(null);
+        }
+    }
+    return true;  // stderr is kept for errors; redirect it to keep a log
 }
 
-void startLinuxScreenKey() {
-    display = XOpenDisplay(nullptr);
-    if (!display) {
-        std::cerr << "Cannot open X display" << std::endl;
-        return;
+// Opens one capture instance per display; false if any of them fails
+bool openDisplays() {
+    if (displayNames.empty()) {
+        displayNames.push_back(nullptr);
     }
 
-    initializeKeyMappings();
+    if (composeEnabled) {
+        bool loaded = composePath.empty() ? composeTable.loadDefault() : composeTable.loadFile(composePath);
+        if (!loaded && !composePath.empty()) {
+            return false;
+        }
+        std::cerr << "Compose table: " << composeTable.size() << " sequences, "
+                  << (composeTable.memoryBytes() + 1023) / 1024 << " KiB" << std::endl;
+    }
 
-    int opcode, event, error;
-    if (!XQueryExtension(display, "XInputExtension", &opcode, &event, &error)) {
-        std::cerr << "X Input extension not available" << std::endl;
-        XCloseDisplay(display);
-        return;
+    for (const char *name : displayNames) {
+        ScreenKey *screenKey = new ScreenKey();
+        screenKeys.push_back(screenKey);
+        screenKey->setListener([screenKey](const KeyEvent &event) { handleKeyEvent(*screenKey, event); });
+        screenKey->setStats(keyStats);
+        screenKey->setCompose(composeEnabled ? &composeTable : nullptr);
+        screenKey->setResyncInterval(resyncIntervalMs);
+        screenKey->setPerDeviceState(perDeviceState);
+        screenKey->setPrivacyRules(privacyRules);
+        screenKey->setDragThreshold(dragThreshold);
+        screenKey->sequences().setTimeout(sequenceTimeoutMs);
+        if (!sequencesPath.empty() && !screenKey->sequences().loadFile(sequencesPath)) {
+            return false;
+        }
+        if (!profilesPath.empty() && !screenKey->profiles().loadFile(profilesPath)) {
+            return false;
+        }
+        if (!screenKey->open(name)) {
+            return false;
+        }
     }
+    return true;
+}
 
-    Window root = DefaultRootWindow(display);
+void startLinuxScreenKey() {
+    traceSetThreadName("capture");
 
-    XIEventMask evmask;
-    unsigned char mask[(XI_LASTEVENT + 7) / 8] = {0};
-    evmask.deviceid = XIAllDevices;
-    evmask.mask_len = sizeof(mask);
-    evmask.mask = mask;
+    // Every display connection is polled from this one thread, so the
+    // listeners and sinks never run concurrently
+    std::vector<pollfd> fds;
+    while (!quit) {
+        const Config *config = configStore.current();
+        if (config && config->generation != appliedConfig) {
+            applyConfig(*config);
+        }
+        configStore.quiescent();  // No Config pointer is held past this point
+        int timeout = updateDisplay();
+
+        fds.clear();
+        bool pending = false;
+        for (ScreenKey *screenKey : screenKeys) {
+            fds.push_back({screenKey->fd(), POLLIN, 0});
+            pending = pending || screenKey->pending();
+        }
+        size_t serverFds = fds.size();
+        if (eventServer) {
+            eventServer->addPollFds(fds);
+        }
+        size_t controlFds = fds.size();
+        if (controlServer) {
+            controlServer->addPollFds(fds);
+        }
 
-    XISetMask(mask, XI_KeyPress);
-    XISetMask(mask, XI_KeyRelease);
-    XISetMask(mask, XI_ButtonPress);
-    XISetMask(mask, XI_ButtonRelease);
+        // Wait with a timeout so resyncs and 'q' are handled while idle
+        if (poll(fds.data(), fds.size(), pending ? 0 : timeout) > 0) {
+            if (eventServer) {
+                eventServer->handlePollFds(fds.data() + serverFds, controlFds - serverFds);
+            }
+            if (controlServer) {
+                controlServer->handlePollFds(fds.data() + controlFds, fds.size() - controlFds);
+            }
+        }
 
-    XISelectEvents(display, root, &evmask, 1);
+        for (ScreenKey *screenKey : screenKeys) {
+            screenKey->dispatch();
+        }
+    }
 
-    while (!quit) {
-        XEvent event;
-        XNextEvent(display, &event);
-
-        if (event.xcookie.type == GenericEvent && event.xcookie.extension == opcode) {
-            XGetEventData(display, &event.xcookie);
-            XIDeviceEvent *xide = (XIDeviceEvent *)event.xcookie.data;
-
-            if (event.xcookie.evtype == XI_KeyPress) {
-                handleLinuxKeyPress(xide);
-            } else if (event.xcookie.evtype == XI_KeyRelease) {
-                handleLinuxKeyRelease(xide);
-            } else if (event.xcookie.evtype == XI_ButtonPress) {
-                handleLinuxButtonPress(xide);
-            } else if (event.xcookie.evtype == XI_ButtonRelease) {
-                handleLinuxButtonRelease(xide);
+    for (ScreenKey *screenKey : screenKeys) {
+        screenKey->close();
+    }
+}
+#endif
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --daemon                Run in the background without a terminal view, controlled with screen_key_ctl\n"
+              << "  --control PATH          Accept commands (pause, resume, renderer, clear, stats, reload, status, quit)\n"
+              << "                          on a Unix socket at PATH (--daemon default $XDG_RUNTIME_DIR/cscreenkey.sock)\n"
+              << "  --renderer NAME         Terminal view: ncurses (default), ansi (plain escape sequences) or none\n"
+              << "  --config FILE           Read labels, colors and pacing from FILE and reload it when it changes\n"
+              << "                          (default ~/.config/cscreenkey.conf when it exists)\n"
+              << "  --display NAME          Capture X display NAME (e.g. :1); repeat to follow several displays\n"
+              << "  --device-labels         Prefix the shown keys with the name of the keyboard or mouse that sent them\n"
+              << "  --per-device            Keep the pressed keys of each keyboard apart, e.g. for two people typing\n"
+              << "  --private RULE          Hide keys typed while a matching window is focused: class:GLOB, title:GLOB\n"
+              << "                          or GLOB for both (e.g. class:KeePassXC, title:*sudo*); repeatable\n"
+              << "  --drag-threshold PX     Show a held mouse button as a drag once it moved PX pixels, 0 disables (default 8)\n"
+              << "  --sequences FILE        Recognise key sequences listed in FILE\n"
+              << "  --profiles FILE         Name chords per application (e.g. Ctrl+w is Close tab in firefox) from FILE\n"
+              << "  --sequence-timeout MS   Maximum pause between chords of a sequence (default 1000)\n"
+              << "  --compose FILE          Show what dead-key and Multi_key sequences in FILE compose to (default: the locale's)\n"
+              << "  --no-compose            Show dead keys as typed instead of the composed character\n"
+              << "  --resync-interval MS    Check pressed keys against the X server this often, 0 disables (default 2000)\n"
+              << "  --stats FILE            Count key and chord usage, written to FILE (.json or .csv) on exit and on SIGUSR1\n"
+              << "  --listen PATH           Stream events as JSON lines to clients of a Unix socket at PATH\n"
+              << "  --listen-tcp PORT       Stream events as JSON lines to clients of 127.0.0.1:PORT\n"
+              << "  --shm NAME              Publish events and the pressed state in shared memory NAME (e.g. /cscreenkey)\n"
+              << "  --log FILE              Append every shown combination to FILE with a timestamp\n"
+              << "  --subtitles FILE        Write the shown keys as subtitles (.srt, .vtt or .ass)\n"
+              << "  --subtitle-linger MS    How long a subtitle stays up after the keys are released (default 1500)\n"
+              << "  --trace FILE            Record pipeline timings, written to FILE as Chrome trace JSON on exit and on SIGUSR2\n";
+}
+
+// Returns false when the program should exit without starting
+bool parseArguments(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--daemon") {
+#ifdef __linux__
+            daemonMode = true;
+#endif
+        } else if (arg == "--control" && hasValue) {
+#ifdef __linux__
+            controlPath = argv[++i];
+#else
+            ++i;
+#endif
+        } else if (arg == "--renderer" && hasValue) {
+#ifdef __linux__
+            rendererName = argv[++i];
+#else
+            ++i;
+#endif
+        } else if (arg == "--config" && hasValue) {
+#ifdef __linux__
+            configPath = argv[++i];
+#else
+            ++i;
+#endif
+        } else if (arg == "--display" && hasValue) {
+#ifdef __linux__
+            displayNames.push_back(argv[++i]);
+#else
+            ++i;
+#endif
+        } else if (arg == "--device-labels") {
+#ifdef __linux__
+            deviceLabels = true;
+#endif
+        } else if (arg == "--per-device") {
+#ifdef __linux__
+            perDeviceState = true;
+#endif
+        } else if (arg == "--private" && hasValue) {
+#ifdef __linux__
+            privacyRules.push_back(argv[++i]);
+#else
+            ++i;
+#endif
+        } else if (arg == "--drag-threshold" && hasValue) {
+#ifdef __linux__
+            dragThreshold = std::atoi(argv[++i]);
+#else
+            ++i;
+#endif
+        } else if (arg == "--sequences" && hasValue) {
+#ifdef __linux__
+            sequencesPath = argv[++i];
+#else
+            ++i;
+#endif
+        } else if (arg == "--profiles" && hasValue) {
+#ifdef __linux__
+            profilesPath = argv[++i];
+#else
+            ++i;
+#endif
+        } else if (arg == "--sequence-timeout" && hasValue) {
+#ifdef __linux__
+            sequenceTimeoutMs = std::strtoul(argv[++i], nullptr, 10);
+#else
+            ++i;
+#endif
+        } else if (arg == "--compose" && hasValue) {
+#ifdef __linux__
+            composePath = argv[++i];
+#else
+            ++i;
+#endif
+        } else if (arg == "--no-compose") {
+#ifdef __linux__
+            composeEnabled = false;
+#endif
+        } else if (arg == "--resync-interval" && hasValue) {
+#ifdef __linux__
+            resyncIntervalMs = std::atoi(argv[++i]);
+#else
+            ++i;
+#endif
+        } else if (arg == "--stats" && hasValue) {
+#ifdef __linux__
+            statsPath = argv[++i];
+            keyStats = new KeyStats();
+#else
+            ++i;
+#endif
+        } else if ((arg == "--listen" || arg == "--listen-tcp") && hasValue) {
+#ifdef __linux__
+            if (!eventServer) {
+                eventServer = new EventServer();
+            }
+            bool listening = arg == "--listen" ? eventServer->listenUnix(argv[++i])
+                                               : eventServer->listenTcp(std::atoi(argv[++i]));
+            if (!listening) {
+                return false;
+            }
+#else
+            ++i;
+#endif
+        } else if (arg == "--shm" && hasValue) {
+#ifdef __linux__
+            delete shmPublisher;
+            shmPublisher = new ShmPublisher();
+            if (!shmPublisher->open(argv[++i])) {
+                return false;
+            }
+#else
+            ++i;
+#endif
+        } else if (arg == "--log" && hasValue) {
+#ifdef __linux__
+            if (logFile) {
+                std::fclose(logFile);
+            }
+            logFile = std::fopen(argv[++i], "a");
+            if (!logFile) {
+                perror(argv[i]);
+                return false;
+            }
+#else
+            ++i;
+#endif
+        } else if (arg == "--subtitles" && hasValue) {
+#ifdef __linux__
+            delete subtitleWriter;
+            subtitleWriter = new SubtitleWriter();
+            if (!subtitleWriter->open(argv[++i])) {
+                return false;
             }
-            XFreeEventData(display, &event.xcookie);
+#else
+            ++i;
+#endif
+        } else if (arg == "--subtitle-linger" && hasValue) {
+#ifdef __linux__
+            subtitleLingerMs = std::strtoul(argv[++i], nullptr, 10);
+#else
+            ++i;
+#endif
+        } else if (arg == "--trace" && hasValue) {
+            tracePath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return false;
         }
     }
-
-    XCloseDisplay(display);
+    return true;
 }
+
+int main(int argc, char *argv[]) {
+    // Before either renderer is set up: initscr() and the UTF-8 label widths both need the user's locale
+    std::setlocale(LC_ALL, "");
+
+    if (!parseArguments(argc, argv)) {
+        return 1;
+    }
+
+#ifdef __linux__
+    if (configPath.empty()) {
+        const char *configHome = std::getenv("XDG_CONFIG_HOME");
+        const char *home = std::getenv("HOME");
+        std::string defaultPath = configHome && *configHome ? std::string(configHome) + "/cscreenkey.conf"
+                                : home ? std::string(home) + "/.config/cscreenkey.conf" : "";
+        if (!defaultPath.empty() && access(defaultPath.c_str(), R_OK) == 0) {
+            configPath = defaultPath;
+        }
+    }
+    if (!configPath.empty() && !configStore.load(configPath)) {
+        return 1;
+    }
+    if (!openDisplays()) {
+        return 1;
+    }
+    rendererExplicit = !rendererName.empty();
+    if (configStore.current()) {
+        configRenderer = configStore.current()->renderer;
+        if (rendererName.empty()) {
+            rendererName = configRenderer;
+        }
+    }
+    if (rendererName == "ansi") {
+        terminalRenderer = renderer = RENDERER_ANSI;
+    } else if (rendererName == "none") {
+        renderer = RENDERER_NONE;
+    } else if (!rendererName.empty() && rendererName != "ncurses") {
+        std::cerr << "Unknown renderer '" << rendererName << "'" << std::endl;
+        return 1;
+    }
+    if (daemonMode) {
+        renderer = RENDERER_NONE;
+        if (controlPath.empty()) {
+            controlPath = defaultControlPath();
+        }
+    }
+    if (!controlPath.empty()) {
+        controlServer = new ControlServer();
+        controlServer->setHandler(handleControlCommand);
+        if (!controlServer->listen(controlPath)) {
+            return 1;
+        }
+    }
+    // Fork before any thread is started
+    if (daemonMode && !daemonize()) {
+        return 1;
+    }
+    if (!configPath.empty() && !configStore.startWatching()) {
+        return 1;
+    }
+    signal(SIGTERM, [](int) { stopRequested = 1; });
+    signal(SIGINT, [](int) { stopRequested = 1; });
+    if (subtitleWriter) {
+        subtitleWriter->setLinger(subtitleLingerMs);
+    }
+    if (keyStats) {
+        signal(SIGUSR1, [](int) { statsRequested = 1; });
+    }
+    if (!tracePath.empty()) {
+        signal(SIGUSR2, [](int) { traceRequested = 1; });
+    }
 #endif
 
-int main() {
+    if (!tracePath.empty()) {
+        traceSetThreadName("main");
+        traceStart();
+    }
+
+#ifdef __linux__
+    if (terminalRenderer == RENDERER_ANSI && !daemonMode) {
+        ansiRenderer.open(STDOUT_FILENO, STDIN_FILENO);
+    } else if (!daemonMode) {
+        initNcurses();  // Initialize ncurses
+    }
+    if (!daemonMode) {
+        terminalSink = displayHub.subscribeLatest("terminal", frameIntervalMs, drawSnapshot);
+    }
+    if (logFile) {
+        displayHub.subscribeEvery("log", logSnapshot);
+    }
+    displayHub.start();
+#else
     initNcurses();  // Initialize ncurses
+#endif
 
 #ifdef _WIN32
     std::thread screenKeyThread(startWindowsScreenKey);
@@ -324,10 +757,31 @@ int main() {
 #endif
 
     while (!quit) {
+#ifdef __linux__
+        int key = daemonMode ? -1 : terminalRenderer == RENDERER_ANSI ? ansiRenderer.readKey() : getch();
+        if (key == 'q') {
+            quit = true;  // Press 'q' to quit the program
+        }
+        if (stopRequested) {
+            quit = true;
+        }
+#else
         int ch = getch();  // Get user input
         if (ch == 'q') {
             quit = true;  // Press 'q' to quit the program
         }
+#endif
+
+#ifdef __linux__
+        if (statsRequested) {
+            statsRequested = 0;
+            keyStats->exportTo(statsPath);
+        }
+        if (traceRequested) {
+            traceRequested = 0;
+            traceWrite(tracePath);
+        }
+#endif
 
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
@@ -335,7 +789,54 @@ int main() {
     if (screenKeyThread.joinable()) {
         screenKeyThread.join();
     }
-
+#ifdef __linux__
+    configStore.stopWatching();
+    displayHub.stop();  // Draws and logs what is still pending
+    if (terminalRenderer == RENDERER_ANSI) {
+        ansiRenderer.close();
+    } else if (!daemonMode) {
+        endwin();  // End ncurses mode
+    }
+#else
     endwin();  // End ncurses mode
+#endif
+
+    if (!tracePath.empty() && traceWrite(tracePath)) {
+        std::cerr << "Trace written to " << tracePath << std::endl;
+    }
+
+#ifdef __linux__
+    unsigned long resyncRuns = 0, resyncFixedKeys = 0;
+    for (ScreenKey *screenKey : screenKeys) {
+        resyncRuns += screenKey->resyncRuns();
+        resyncFixedKeys += screenKey->resyncFixedKeys();
+        delete screenKey;
+    }
+    std::cerr << "Pressed-state resync: " << resyncRuns << " checks, "
+              << resyncFixedKeys << " keys corrected" << std::endl;
+
+    for (size_t i = 0; i < displayHub.size(); i++) {
+        SnapshotHub::Stats sink = displayHub.stats(i);
+        std::cerr << "Display sink " << sink.name << ": " << sink.delivered << " delivered, "
+                  << sink.skipped << " skipped, " << sink.dropped << " dropped" << std::endl;
+    }
+    if (logFile) {
+        std::fclose(logFile);
+    }
+
+    if (keyStats && keyStats->exportTo(statsPath)) {
+        std::cerr << "Usage statistics written to " << statsPath << std::endl;
+    }
+    delete keyStats;
+
+    if (eventServer && eventServer->droppedClients()) {
+        std::cerr << "Event stream: " << eventServer->droppedClients()
+                  << " slow clients disconnected" << std::endl;
+    }
+    delete eventServer;
+    delete shmPublisher;
+    delete subtitleWriter;  // Writes the last cue
+    delete controlServer;
+#endif
     return 0;
 }
@@ -0,0 +1,859 @@
+// Microbenchmarks for each stage of the capture -> render pipeline. Every
+// result is printed as one line of JSON (or CSV with --format csv) so runs can
+// be stored and compared between releases.
+//
+//   g++ -O2 CScreenkeyBench.cpp NcursesRenderer.cpp AnsiRenderer.cpp TextWidth.cpp libcscreenkey.a -o cscreenkey_bench
+//       -lncursesw -lutil -lpthread -lX11 -lXi -lXtst -lrt
+//   ./cscreenkey_bench [--filter TEXT] [--format json|csv] [--min-time MS]
+//
+// Keycode translation needs an X display; without one those benchmarks are
+// reported as skipped.
+//
+// Built with -DCSK_ALLOC_TRACKING (library included) and AllocTracker.cpp, it
+// also replays synthetic XI2 key events through the real ScreenKey handlers
+// (ScreenKey::injectEvent, no X server needed) and fails when the
+// steady-state allocations per event exceed --alloc-budget.
+//
+// check/* replays short event sequences through ScreenKey::injectEvent()
+// (or feeds a SequenceMatcher directly) and fails the run when the result
+// is wrong.
+//
+// --trace FILE records every stage span of the run as Chrome trace JSON.
+//
+// capture/* injects key presses with XTest (link -lXtst) and times how fast
+// the compiled capture backend reads them back, in wall and CPU time per
+// event; build once plainly and once with -DCSK_XCB_BACKEND to compare.
+//
+// fanout/* times SnapshotHub::publish() to a terminal (30 Hz), an overlay
+// (60 Hz) and a log sink, then again with a sink that takes 50 ms per snapshot.
+//
+// render/* draws into a pty with ncurses and with the ANSI renderer and also
+// reports the bytes and write() calls each frame costs.
+
+#include "ScreenKey.h"
+#include "KeyState.h"
+#include "NcursesRenderer.h"
+#include "AnsiRenderer.h"
+#include "SnapshotHub.h"
+#include "AllocTracker.h"
+#include "Trace.h"
+#include "SubtitleWriter.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ncurses.h>
+#include <pty.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#include <poll.h>
+#include <ctime>
+#include <clocale>
+#include <langinfo.h>
+#include <fstream>
+
+std::string benchFilter;
+std::string tracePath;
+std::string format = "json";
+double minTimeMs = 200;
+double allocBudget = -1;  // Allocations per event, negative when unchecked
+int failedChecks = 0;
+
+// Keeps the compiler from optimizing a benchmarked value away
+template <typename T>
+inline void keep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+void report(const std::string &name, uint64_t iterations, double nsPerOp, const char *skipped = nullptr) {
+    if (format == "csv") {
+        std::printf("%s,%llu,%.2f,%s\n", name.c_str(), static_cast<unsigned long long>(iterations),
+                    nsPerOp, skipped ? skipped : "");
+    } else if (skipped) {
+        std::printf("{\"benchmark\":\"%s\",\"skipped\":\"%s\"}\n", name.c_str(), skipped);
+    } else {
+        std::printf("{\"benchmark\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f}\n", name.c_str(),
+                    static_cast<unsigned long long>(iterations), nsPerOp);
+    }
+    std::fflush(stdout);
+}
+
+bool selected(const std::string &name) {
+    return benchFilter.empty() || name.find(benchFilter) != std::string::npos;
+}
+
+// Runs body(i) in batches until minTimeMs has passed and reports the best batch
+template <typename Body>
+void runBenchmark(const std::string &name, Body body) {
+    if (!selected(name)) {
+        return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    uint64_t batch = 1;
+    uint64_t total = 0;
+    double best = 1e300;
+    auto start = Clock::now();
+
+    while (std::chrono::duration<double, std::milli>(Clock::now() - start).count() < minTimeMs) {
+        auto batchStart = Clock::now();
+        for (uint64_t i = 0; i < batch; i++) {
+            body(i);
+        }
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - batchStart).count();
+        total += batch;
+        best = std::min(best, ns / batch);
+        if (ns < 1e6) {
+            batch *= 2;  // Grow batches until one takes about a millisecond
+        }
+    }
+    report(name, total, best);
+}
+
+// A typing mix: letters, digits, modifiers and keys that have special labels
+std::vector<KeySym> sampleKeysyms() {
+    std::vector<KeySym> keysyms;
+    for (KeySym k = XK_a; k <= XK_z; k++) keysyms.push_back(k);
+    for (KeySym k = XK_0; k <= XK_9; k++) keysyms.push_back(k);
+    for (KeySym k : {XK_Control_L, XK_Shift_L, XK_Alt_L, XK_Left, XK_Right, XK_Up, XK_Down,
+                     XK_comma, XK_period, XK_slash, XK_Return, XK_space, XK_BackSpace, XK_Home}) {
+        keysyms.push_back(k);
+    }
+    return keysyms;
+}
+
+void benchTranslation() {
+    if (!selected("translate/")) {
+        return;
+    }
+
+    Display *display = XOpenDisplay(nullptr);
+    if (!display) {
+        report("translate/xkb_keycode_to_keysym", 0, 0, "no display");
+        report("translate/cached_table", 0, 0, "no display");
+        return;
+    }
+
+    int minKeycode, maxKeycode;
+    XDisplayKeycodes(display, &minKeycode, &maxKeycode);
+    int range = maxKeycode - minKeycode + 1;
+
+    runBenchmark("translate/xkb_keycode_to_keysym", [&](uint64_t i) {
+        keep(XkbKeycodeToKeysym(display, minKeycode + i % range, 0, 0));
+    });
+
+    KeySym cache[256] = {0};
+    for (int keycode = minKeycode; keycode <= maxKeycode; keycode++) {
+        cache[keycode & 255] = XkbKeycodeToKeysym(display, keycode, 0, 0);
+    }
+    runBenchmark("translate/cached_table", [&](uint64_t i) {
+        keep(cache[(minKeycode + i % range) & 255]);
+    });
+
+    XCloseDisplay(display);
+}
+
+#ifdef CSK_XCB_BACKEND
+const char *CAPTURE_BACKEND = "xcb";
+#else
+const char *CAPTURE_BACKEND = "xlib";
+#endif
+
+double threadCpuNs() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// End to end through the X server: a second connection sends key events with
+// XTest while this thread polls and dispatches them like the front end does
+void benchCapture() {
+    std::string wallName = std::string("capture/") + CAPTURE_BACKEND + "_wall_per_event";
+    std::string cpuName = std::string("capture/") + CAPTURE_BACKEND + "_cpu_per_event";
+    if (!selected(wallName) && !selected(cpuName)) {
+        return;
+    }
+
+    int eventBase, errorBase, major, minor;
+    Display *injector = XOpenDisplay(nullptr);
+    if (!injector || !XTestQueryExtension(injector, &eventBase, &errorBase, &major, &minor)) {
+        report(wallName, 0, 0, injector ? "no XTest" : "no display");
+        report(cpuName, 0, 0, injector ? "no XTest" : "no display");
+        if (injector) {
+            XCloseDisplay(injector);
+        }
+        return;
+    }
+
+    uint64_t received = 0;
+    ScreenKey capture;
+    capture.setResyncInterval(0);
+    capture.setListener([&](const KeyEvent &event) {
+        received += event.type == KEY_EVENT_PRESS || event.type == KEY_EVENT_RELEASE;
+    });
+    if (!capture.open()) {
+        report(wallName, 0, 0, "open failed");
+        report(cpuName, 0, 0, "open failed");
+        XCloseDisplay(injector);
+        return;
+    }
+
+    // Shift types nothing into whatever window has the focus
+    const uint64_t events = 20000;
+    KeyCode key = XKeysymToKeycode(injector, XK_Shift_L);
+    XSync(injector, False);
+
+    double cpuStart = threadCpuNs();
+    auto start = std::chrono::steady_clock::now();
+    std::thread sender([&] {
+        for (uint64_t i = 0; i < events / 2; i++) {
+            XTestFakeKeyEvent(injector, key, True, 0);
+            XTestFakeKeyEvent(injector, key, False, 0);
+            if (i % 64 == 0) {
+                XFlush(injector);
+            }
+        }
+        XSync(injector, False);
+    });
+
+    while (received < events &&
+           std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+        pollfd fd = {capture.fd(), POLLIN, 0};
+        poll(&fd, 1, capture.pending() ? 0 : 100);
+        capture.dispatch();
+    }
+    double wallNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double cpuNs = threadCpuNs() - cpuStart;
+    sender.join();
+
+    if (received == 0) {
+        report(wallName, 0, 0, "no events received");
+        report(cpuName, 0, 0, "no events received");
+    } else {
+        report(wallName, received, wallNs / received);
+        report(cpuName, received, cpuNs / received);
+    }
+    capture.close();
+    XCloseDisplay(injector);
+}
+
+void benchLabels() {
+    ScreenKey screenKey;  // Not opened, only used for its label table
+    const std::map<int, std::string> &labels = screenKey.labels();
+    std::unordered_map<int, std::string> hashed(labels.begin(), labels.end());
+    std::vector<std::pair<int, std::string>> sorted(labels.begin(), labels.end());
+    std::vector<KeySym> keysyms = sampleKeysyms();
+
+    runBenchmark("label/std_map", [&](uint64_t i) {
+        auto found = labels.find(keysyms[i % keysyms.size()]);
+        keep(found == labels.end() ? nullptr : &found->second);
+    });
+
+    runBenchmark("label/unordered_map", [&](uint64_t i) {
+        auto found = hashed.find(keysyms[i % keysyms.size()]);
+        keep(found == hashed.end() ? nullptr : &found->second);
+    });
+
+    runBenchmark("label/sorted_vector", [&](uint64_t i) {
+        int keysym = keysyms[i % keysyms.size()];
+        auto found = std::lower_bound(sorted.begin(), sorted.end(), keysym,
+                                      [](const std::pair<int, std::string> &entry, int key) { return entry.first < key; });
+        keep(found == sorted.end() || found->first != keysym ? nullptr : &found->second);
+    });
+
+    runBenchmark("label/xkeysym_to_string", [&](uint64_t i) {
+        keep(XKeysymToString(keysyms[i % keysyms.size()]));
+    });
+}
+
+// Keycodes 10.. stand for the sample keysyms, so the pipeline runs without a server
+std::vector<std::pair<int, KeySym>> sampleKeycodes() {
+    std::vector<std::pair<int, KeySym>> keycodes;
+    for (KeySym keysym : sampleKeysyms()) {
+        keycodes.emplace_back(10 + static_cast<int>(keycodes.size()), keysym);
+    }
+    return keycodes;
+}
+
+// One keystroke through the real capture path: ScreenKey::handleKeyPress or
+// handleKeyRelease (label table, held labels, compose, sequences, statistics)
+// and KeyState, ending in the front end's uppercasing. Every key is pressed in
+// turn, then released in turn.
+void simulateEvent(ScreenKey &screenKey, size_t keyCount, uint64_t i) {
+    XIDeviceEvent event = {};
+    event.detail = 10 + static_cast<int>(i % keyCount);
+    event.deviceid = event.sourceid = 3;
+    event.time = static_cast<Time>(i);
+    screenKey.injectEvent((i / keyCount) % 2 == 0 ? XI_KeyPress : XI_KeyRelease, &event);
+}
+
+// Sets up a ScreenKey the way the front end does, minus the X connection
+void preparePipeline(ScreenKey &screenKey, ComposeTable &compose, KeyStats &stats) {
+    screenKey.loadKeysyms(sampleKeycodes());
+    std::string error;
+    screenKey.sequences().addSequence("Ctrl+x Ctrl+s", "Save buffer", error);
+    screenKey.sequences().addSequence("g g", "Go to top", error);
+    if (compose.loadDefault()) {
+        screenKey.setCompose(&compose);
+    }
+    screenKey.setStats(&stats);
+    screenKey.setListener([](const KeyEvent &event) {
+        CSK_ALLOC_SCOPE("showPressedKey");
+        std::string upper = toUppercase(event.combination);
+        keep(upper.data());
+    });
+}
+
+void benchPipeline() {
+    size_t keyCount = sampleKeysyms().size();
+    ComposeTable compose;
+    KeyStats stats;
+    ScreenKey screenKey;
+    preparePipeline(screenKey, compose, stats);
+
+    runBenchmark("pipeline/event", [&](uint64_t i) {
+        simulateEvent(screenKey, keyCount, i);
+    });
+
+#ifdef CSK_ALLOC_TRACKING
+    // Replay again from a clean state for the steady-state allocation rate
+    KeyStats replayStats;
+    ScreenKey replay;
+    preparePipeline(replay, compose, replayStats);
+    for (uint64_t i = 0; i < 1000; i++) {
+        simulateEvent(replay, keyCount, i);
+    }
+    allocTrackerStartSteadyState();
+    for (uint64_t i = 1000; i < 11000; i++) {
+        simulateEvent(replay, keyCount, i);
+    }
+#endif
+}
+
+void benchState() {
+    std::vector<std::string> names;
+    for (KeySym keysym : sampleKeysyms()) {
+        names.push_back(XKeysymToString(keysym));
+    }
+
+    KeyState state;
+    runBenchmark("state/insert_erase", [&](uint64_t i) {
+        const std::string &name = names[i % names.size()];
+        state.add(name);
+        state.remove(name);
+    });
+
+    // Two modifiers held while letters come and go, as in a typical shortcut
+    KeyState shortcut;
+    shortcut.setListener([](const KeyEvent &event) { keep(event.combination[0]); });
+    shortcut.add("Control_L");
+    shortcut.add("Shift_L");
+    runBenchmark("format/update_combination", [&](uint64_t i) {
+        const std::string &name = names[i % 26];
+        shortcut.add(name);
+        shortcut.emit(KEY_EVENT_PRESS, 0, name, i);
+        shortcut.remove(name);
+    });
+
+    std::string combination = "Control_L + Shift_L + s";
+    runBenchmark("format/uppercase", [&](uint64_t) {
+        std::string upper = toUppercase(combination);
+        keep(upper.data());
+    });
+}
+
+void benchTrace(bool keepTracing) {
+    if (!selected("trace/")) {
+        return;
+    }
+
+    traceEnabled = false;
+    runBenchmark("trace/span_disabled", [](uint64_t i) {
+        CSK_TRACE_SCOPE("bench");
+        keep(i);
+    });
+
+    traceStart();
+    runBenchmark("trace/span_enabled", [](uint64_t i) {
+        CSK_TRACE_SCOPE("bench");
+        keep(i);
+    });
+    traceEnabled = keepTracing;
+}
+
+void reportCheck(const std::string &name, bool passed) {
+    if (!passed) {
+        failedChecks++;
+    }
+    if (format == "csv") {
+        std::printf("%s,0,0,%s\n", name.c_str(), passed ? "" : "failed");
+    } else {
+        std::printf("{\"benchmark\":\"%s\",\"passed\":%s}\n", name.c_str(), passed ? "true" : "false");
+    }
+    std::fflush(stdout);
+}
+
+void injectTouch(ScreenKey &screenKey, int type, int id, double x, double y) {
+    unsigned char mask[1] = {0};
+    XISetMask(mask, 0);
+    XISetMask(mask, 1);
+    double values[2] = {x, y};
+    XIRawEvent event = {};
+    event.detail = id;
+    event.deviceid = event.sourceid = 12;
+    event.valuators.mask_len = sizeof(mask);
+    event.valuators.mask = mask;
+    event.valuators.values = values;
+    screenKey.injectEvent(type, &event);
+}
+
+void benchChecks() {
+    // A two-finger scroll keeps its label when one finger lifts and the other rests
+    if (selected("check/touch_two_to_one_finger")) {
+        ScreenKey screenKey;
+        std::string shown;
+        screenKey.setListener([&](const KeyEvent &event) { shown = event.combination; });
+        injectTouch(screenKey, XI_RawTouchBegin, 1, 100, 100);
+        injectTouch(screenKey, XI_RawTouchBegin, 2, 200, 100);
+        injectTouch(screenKey, XI_RawTouchUpdate, 2, 200, 160);
+        bool scrolled = shown == "TWO-FINGER SCROLL DOWN";
+        injectTouch(screenKey, XI_RawTouchEnd, 2, 200, 160);
+        injectTouch(screenKey, XI_RawTouchUpdate, 1, 100, 100);
+        bool kept = shown == "TWO-FINGER SCROLL DOWN";
+        injectTouch(screenKey, XI_RawTouchEnd, 1, 100, 100);
+        reportCheck("check/touch_two_to_one_finger", scrolled && kept && shown.empty());
+    }
+
+    // Fingers lifted and put back free their slots, so a long gesture keeps tracking new touches
+    if (selected("check/touch_slots_reused")) {
+        ScreenKey screenKey;
+        std::string shown;
+        screenKey.setListener([&](const KeyEvent &event) { shown = event.combination; });
+        injectTouch(screenKey, XI_RawTouchBegin, 1, 100, 100);
+        for (int id = 2; id < 14; id++) {
+            injectTouch(screenKey, XI_RawTouchBegin, id, 200, 100);
+            injectTouch(screenKey, XI_RawTouchEnd, id, 200, 100);
+        }
+        injectTouch(screenKey, XI_RawTouchBegin, 20, 200, 100);
+        injectTouch(screenKey, XI_RawTouchUpdate, 20, 200, 160);
+        injectTouch(screenKey, XI_RawTouchUpdate, 1, 100, 160);
+        reportCheck("check/touch_slots_reused", shown == "TWO-FINGER SCROLL DOWN");
+    }
+
+    // A legacy wheel notch arrives as button 5 and as emulated valuator motion; it counts once
+    if (selected("check/wheel_notch_counted_once")) {
+        ScreenKey screenKey;
+        screenKey.loadScrollAxis(12, 3, false, 15);
+        std::string shown;
+        screenKey.setListener([&](const KeyEvent &event) { shown = event.combination; });
+
+        XIDeviceEvent button = {};
+        button.deviceid = button.sourceid = 12;
+        button.detail = 5;
+        button.time = 100;
+        screenKey.injectEvent(XI_ButtonPress, &button);
+        screenKey.injectEvent(XI_ButtonRelease, &button);
+
+        unsigned char mask[1] = {0};
+        XISetMask(mask, 3);
+        double values[1] = {15};
+        XIDeviceEvent motion = {};
+        motion.deviceid = motion.sourceid = 12;
+        motion.flags = XIPointerEmulated;
+        motion.time = 100;
+        motion.valuators.mask_len = sizeof(mask);
+        motion.valuators.mask = mask;
+        motion.valuators.values = values;
+        screenKey.injectEvent(XI_Motion, &motion);
+        reportCheck("check/wheel_notch_counted_once", shown == "MOUSE SCROLL DOWN");
+    }
+
+    // A completed sequence's name is not carried over to the next bare modifier
+    if (selected("check/command_cleared_on_new_chord")) {
+        ScreenKey screenKey;
+        screenKey.loadKeysyms(sampleKeycodes());
+        std::string error;
+        screenKey.sequences().addSequence("Ctrl+x Ctrl+s", "Save buffer", error);
+        const int CONTROL = 46, X = 33, S = 28;  // Positions in sampleKeysyms()
+        XIDeviceEvent event = {};
+        auto key = [&](int type, int keycode) {
+            event.detail = keycode;
+            event.mods.effective = keycode == CONTROL ? 0 : ControlMask;
+            event.time += 10;
+            screenKey.injectEvent(type, &event);
+        };
+        key(XI_KeyPress, CONTROL);
+        key(XI_KeyPress, X);
+        key(XI_KeyRelease, X);
+        key(XI_KeyPress, S);
+        bool named = screenKey.combination() == "Control_L + s  =>  Save buffer";
+        key(XI_KeyRelease, S);
+        key(XI_KeyRelease, CONTROL);
+        key(XI_KeyPress, CONTROL);
+        reportCheck("check/command_cleared_on_new_chord", named && screenKey.combination() == "Control_L");
+    }
+
+    // A rejected sequence leaves no prefix behind, and a name may contain " = " or '#'
+    if (selected("check/sequence_parsing")) {
+        SequenceMatcher matcher;
+        std::string error;
+        bool rejected = !matcher.addSequence("Ctrl+x Ctrl+c NoSuchKey", "Quit", error);
+        bool added = matcher.addSequence("Ctrl+x", "Cut", error);
+
+        char path[] = "/tmp/cscreenkey-check-XXXXXX";
+        int fd = mkstemp(path);
+        const std::string *command = nullptr, *hashName = nullptr;
+        if (fd >= 0) {
+            const char lines[] = "# comment\ng g = Go to line = 1\nCtrl+g = Go to #\n";
+            bool written = write(fd, lines, sizeof(lines) - 1) == sizeof(lines) - 1;
+            ::close(fd);
+            if (written && matcher.loadFile(path)) {
+                matcher.advance(makeChord(0, XK_g), 0);
+                command = matcher.advance(makeChord(0, XK_g), 10);
+                hashName = matcher.advance(makeChord(CHORD_CTRL, XK_g), 20);
+            }
+            unlink(path);
+        }
+        reportCheck("check/sequence_parsing", rejected && added && command && *command == "Go to line = 1" &&
+                    hashName && *hashName == "Go to #");
+    }
+
+    // A chord that breaks a pending sequence but continues it from a later point still completes it
+    if (selected("check/sequence_overlap")) {
+        SequenceMatcher matcher;
+        std::string error;
+        matcher.addSequence("g g d", "Delete to top", error);
+        const std::string *command = nullptr;
+        unsigned long time = 0;
+        for (KeySym keysym : {XK_g, XK_g, XK_g, XK_d}) {
+            command = matcher.advance(makeChord(0, keysym), time += 10);
+        }
+        reportCheck("check/sequence_overlap", command && *command == "Delete to top");
+    }
+
+    // A label wider than the terminal is cut between UTF-8 characters, not inside one
+    if (selected("check/ansi_truncate_multibyte")) {
+        int master, slave;
+        winsize size = {3, 14, 0, 0};
+        std::string written;
+        if (openpty(&master, &slave, nullptr, nullptr, &size) == 0) {
+            AnsiRenderer ansi;
+            ansi.open(slave, -1);
+            ansi.render("DEAD_ACUTE (\u00b4) + E");
+            ansi.close();
+            char buffer[4096];
+            pollfd fd = {master, POLLIN, 0};
+            while (poll(&fd, 1, 0) > 0) {
+                ssize_t n = read(master, buffer, sizeof(buffer));
+                if (n <= 0) {
+                    break;
+                }
+                written.append(buffer, n);
+            }
+            close(slave);
+            close(master);
+        }
+        reportCheck("check/ansi_truncate_multibyte", written.find("DEAD_ACUTE (\u00b4\u2026") != std::string::npos);
+    }
+
+    // A chord repeated after its cue ran out starts a new cue instead of stretching the old one
+    if (selected("check/subtitle_repeat_after_gap")) {
+        char path[] = "/tmp/cscreenkey-check-XXXXXX.srt";
+        int fd = mkstemps(path, 4);
+        int cues = 0;
+        if (fd >= 0) {
+            ::close(fd);
+            SubtitleWriter writer;
+            if (writer.open(path)) {
+                writer.show("CONTROL_L + S", 1000);
+                writer.show("", 1100);
+                writer.show("CONTROL_L + S", 61000);
+                writer.show("", 61100);
+                writer.show("A", 70000);
+                writer.close();
+                std::ifstream file(path);
+                std::string line;
+                while (std::getline(file, line)) {
+                    cues += line.find(" --> ") != std::string::npos;
+                }
+            }
+            unlink(path);
+        }
+        reportCheck("check/subtitle_repeat_after_gap", cues == 3);
+    }
+
+    // A key pressed again with another label (here after a map change) leaves nothing behind
+    if (selected("check/relabeled_press_released")) {
+        ScreenKey screenKey;
+        screenKey.loadKeysyms({{10, XK_1}});
+        XIDeviceEvent event = {};
+        event.deviceid = event.sourceid = 20;
+        event.detail = 10;
+        screenKey.injectEvent(XI_KeyPress, &event);
+        screenKey.loadKeysyms({{10, XK_exclam}});
+        screenKey.injectEvent(XI_KeyPress, &event);
+        bool relabeled = screenKey.combination() == "exclam";
+        screenKey.injectEvent(XI_KeyRelease, &event);
+        reportCheck("check/relabeled_press_released", relabeled && screenKey.combination().empty());
+    }
+
+    // A key a resync finds down while a private window has the focus is tracked but never shown or published
+    if (selected("check/private_resync_hidden")) {
+        ScreenKey screenKey;
+        screenKey.loadKeysyms(sampleKeycodes());
+        screenKey.setPrivacyRules({"title:*"});  // Matches any window, even without a display
+        int events = 0;
+        screenKey.setListener([&](const KeyEvent &) { events++; });
+        char serverKeymap[32] = {};
+        serverKeymap[1] = 1 << 2;  // Keycode 10, XK_a
+        screenKey.injectKeymap(serverKeymap);
+        bool tracked = (screenKey.pressedKeymap()[1] & (1 << 2)) && screenKey.combination().empty();
+        serverKeymap[1] = 0;
+        screenKey.injectKeymap(serverKeymap);
+        bool released = !(screenKey.pressedKeymap()[1] & (1 << 2));
+        reportCheck("check/private_resync_hidden", tracked && released && events == 0);
+    }
+
+    // Two keyboards holding the same key each release it
+    if (selected("check/per_device_same_key")) {
+        ScreenKey screenKey;
+        screenKey.loadKeysyms(sampleKeycodes());
+        screenKey.setPerDeviceState(true);
+        XIDeviceEvent event = {};
+        event.detail = 10;  // XK_a
+        for (int device : {20, 21}) {
+            event.sourceid = device;
+            screenKey.injectEvent(XI_KeyPress, &event);
+        }
+        event.sourceid = 20;
+        screenKey.injectEvent(XI_KeyRelease, &event);
+        bool firstReleased = screenKey.combination().empty() && (screenKey.pressedKeymap()[1] & (1 << 2));
+        event.sourceid = 21;
+        screenKey.injectEvent(XI_KeyRelease, &event);
+        bool secondReleased = screenKey.combination().empty() && !(screenKey.pressedKeymap()[1] & (1 << 2));
+        reportCheck("check/per_device_same_key", firstReleased && secondReleased);
+    }
+}
+
+void benchFanout() {
+    if (!selected("fanout/")) {
+        return;
+    }
+    for (bool slowSink : {false, true}) {
+        SnapshotHub hub;
+        std::atomic<unsigned long> logged(0);
+        hub.subscribeLatest("terminal", 1000 / 30, [](const Snapshot &snapshot) { keep(snapshot.sequence); });
+        hub.subscribeLatest("overlay", 1000 / 60, [](const Snapshot &snapshot) { keep(snapshot.sequence); });
+        hub.subscribeEvery("log", [&](const Snapshot &) { logged++; });
+        if (slowSink) {
+            hub.subscribeLatest("slow", 0, [](const Snapshot &) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            });
+        }
+        hub.start();
+        const std::string combinations[] = {"CONTROL_L", "CONTROL_L + S", "CONTROL_L + SHIFT_L + T", "A"};
+        runBenchmark(slowSink ? "fanout/publish_slow_sink" : "fanout/publish", [&](uint64_t i) {
+            hub.publish(combinations[i % 4]);
+        });
+        hub.stop();
+    }
+}
+
+// Bytes and write calls of the whole process so far, from /proc/self/io
+bool readWriteCounters(unsigned long long &bytes, unsigned long long &calls) {
+    std::ifstream io("/proc/self/io");
+    std::string name;
+    unsigned long long value;
+    int found = 0;
+    while (io >> name >> value) {
+        if (name == "wchar:") {
+            bytes = value;
+            found++;
+        } else if (name == "syscw:") {
+            calls = value;
+            found++;
+        }
+    }
+    return found == 2;
+}
+
+// Draws `frames` frames with draw(i) and reports what they wrote to the terminal
+template <typename Draw>
+void reportOutput(const std::string &name, int frames, Draw draw) {
+    if (!selected(name)) {
+        return;
+    }
+    unsigned long long bytesBefore, callsBefore, bytesAfter, callsAfter;
+    if (!readWriteCounters(bytesBefore, callsBefore)) {
+        report(name, 0, 0, "no /proc/self/io");
+        return;
+    }
+    for (int i = 0; i < frames; i++) {
+        draw(i);
+    }
+    readWriteCounters(bytesAfter, callsAfter);
+    double bytesPerFrame = static_cast<double>(bytesAfter - bytesBefore) / frames;
+    double callsPerFrame = static_cast<double>(callsAfter - callsBefore) / frames;
+    if (format == "csv") {
+        std::printf("%s_bytes_per_frame,%d,%.2f,\n", name.c_str(), frames, bytesPerFrame);
+        std::printf("%s_syscalls_per_frame,%d,%.2f,\n", name.c_str(), frames, callsPerFrame);
+    } else {
+        std::printf("{\"benchmark\":\"%s\",\"frames\":%d,\"bytes_per_frame\":%.2f,\"syscalls_per_frame\":%.2f}\n",
+                    name.c_str(), frames, bytesPerFrame, callsPerFrame);
+    }
+    std::fflush(stdout);
+}
+
+void benchRender() {
+    if (!selected("render/")) {
+        return;
+    }
+
+    int master, slave;
+    winsize size = {24, 80, 0, 0};
+    if (openpty(&master, &slave, nullptr, nullptr, &size) < 0) {
+        report("render/ncurses_pty", 0, 0, "openpty failed");
+        return;
+    }
+
+    // Drain the terminal side so ncurses never blocks on a full pty
+    std::atomic<bool> done(false);
+    std::thread drain([&] {
+        char buffer[4096];
+        while (!done && read(master, buffer, sizeof(buffer)) > 0) {
+        }
+    });
+
+    std::FILE *output = fdopen(slave, "w");
+    std::FILE *input = std::fopen("/dev/null", "r");
+    const char *term = std::getenv("TERM");
+    SCREEN *screen = newterm(term && *term ? term : "xterm", output, input);
+    if (!screen) {
+        report("render/ncurses_pty", 0, 0, "newterm failed");
+    } else {
+        set_term(screen);
+        const char *combinations[] = {"CONTROL_L", "CONTROL_L + S", "CONTROL_L + SHIFT_L + T", "A"};
+        cbreak();
+        noecho();
+        curs_set(0);
+        start_color();
+        init_pair(1, COLOR_WHITE, COLOR_BLACK);
+
+        runBenchmark("render/ncurses_pty", [&](uint64_t i) {
+            renderText(combinations[i % 4]);
+        });
+        reportOutput("render/ncurses_pty_output", 1000, [&](int i) {
+            renderText(combinations[i % 4]);
+        });
+
+        endwin();
+        delscreen(screen);
+    }
+
+    {
+        // Same frames with synchronized output on, as on a terminal that supports it
+        AnsiRenderer ansi;
+        ansi.open(slave, -1);
+        ansi.setSynchronizedOutput(true);
+        const std::string combinations[] = {"CONTROL_L", "CONTROL_L + S", "CONTROL_L + SHIFT_L + T", "A"};
+        runBenchmark("render/ansi_pty", [&](uint64_t i) {
+            ansi.render(combinations[i % 4]);
+        });
+        reportOutput("render/ansi_pty_output", 1000, [&](int i) {
+            ansi.render(combinations[i % 4]);
+        });
+        ansi.close();
+    }
+
+    done = true;
+    std::fclose(output);  // Closes the slave, which ends the drain thread's read
+    std::fclose(input);
+    drain.join();
+    close(master);
+}
+
+int main(int argc, char *argv[]) {
+    // As in the front end; the checks measure UTF-8 labels, so fall back to C.UTF-8 without one
+    std::setlocale(LC_ALL, "");
+    if (std::strcmp(nl_langinfo(CODESET), "UTF-8") != 0) {
+        std::setlocale(LC_CTYPE, "C.UTF-8");
+    }
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            benchFilter = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            format = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            minTimeMs = std::atof(argv[++i]);
+        } else if (arg == "--alloc-budget" && i + 1 < argc) {
+            allocBudget = std::atof(argv[++i]);
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--filter TEXT] [--format json|csv] [--min-time MS] [--alloc-budget N] [--trace FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (format == "csv") {
+        std::printf("benchmark,iterations,ns_per_op,skipped\n");
+    }
+
+    benchTrace(!tracePath.empty());
+    if (!tracePath.empty()) {
+        traceStart();
+    }
+
+    benchTranslation();
+    benchCapture();
+    benchLabels();
+    benchState();
+    benchPipeline();
+    benchFanout();
+    benchChecks();
+    benchRender();
+
+    if (!tracePath.empty() && !traceWrite(tracePath)) {
+        return 1;
+    }
+
+    if (failedChecks > 0) {
+        std::cerr << failedChecks << " checks failed" << std::endl;
+        return 1;
+    }
+
+#ifdef CSK_ALLOC_TRACKING
+    double allocsPerEvent = allocTrackerAllocsPerEvent();
+    if (format == "csv") {
+        std::printf("alloc/steady_state_per_event,0,%.2f,\n", allocsPerEvent);
+    } else {
+        std::printf("{\"benchmark\":\"alloc/steady_state\",\"allocs_per_event\":%.2f}\n", allocsPerEvent);
+    }
+    if (allocBudget >= 0 && allocsPerEvent > allocBudget) {
+        std::cerr << "Allocation budget exceeded: " << allocsPerEvent << " allocations per event, budget "
+                  << allocBudget << std::endl;
+        return 1;
+    }
+#else
+    if (allocBudget >= 0) {
+        std::cerr << "--alloc-budget needs a build with -DCSK_ALLOC_TRACKING" << std::endl;
+        return 1;
+    }
+#endif
+    return 0;
+}
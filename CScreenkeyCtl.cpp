@@ -0,0 +1,41 @@
+// Sends one command to a running screen_key started with --daemon or --control
+// and prints its reply; exits with 1 unless the reply starts with "ok".
+//
+//   g++ -O2 CScreenkeyCtl.cpp ControlServer.cpp -o screen_key_ctl
+//   ./screen_key_ctl [--socket PATH] pause|resume|renderer NAME|clear|stats|reload|status|quit
+
+#include "ControlServer.h"
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[]) {
+    std::string path = defaultControlPath();
+    std::string command;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            path = argv[++i];
+        } else {
+            command += (command.empty() ? "" : " ") + arg;
+        }
+    }
+    if (command.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--socket PATH] COMMAND\n"
+                  << "  pause, resume         Stop or restart showing and publishing keys\n"
+                  << "  renderer NAME         Switch the terminal view: none, or the ncurses/ansi one started with\n"
+                  << "  clear                 Forget every pressed key\n"
+                  << "  stats                 Write the --stats file now\n"
+                  << "  reload                Read the config file again\n"
+                  << "  status                Show the daemon's state\n"
+                  << "  quit                  Stop the daemon\n";
+        return 1;
+    }
+
+    std::string reply;
+    if (!sendControlCommand(path, command, reply)) {
+        return 1;
+    }
+    std::cout << reply << std::endl;
+    return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+}
@@ -0,0 +1,337 @@
+#include "ComposeTable.h"
+#include <iostream>
+#include <fstream>
+#include <cctype>
+#include <cstdlib>
+#include <X11/Xlib.h>
+
+static const int MAX_INCLUDE_DEPTH = 4;
+
+static std::string trim(const std::string &text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+static std::string localeDir() {
+    const char *dir = std::getenv("XLOCALEDIR");
+    return dir && *dir ? dir : "/usr/share/X11/locale";
+}
+
+// The user's locale as compose.dir spells it ("en_US.utf8" -> "en_US.UTF-8");
+// C and POSIX fall back to en_US.UTF-8, whose table has every common sequence
+static std::string localeName() {
+    const char *names[] = {"LC_ALL", "LC_CTYPE", "LANG"};
+    std::string locale;
+    for (const char *name : names) {
+        const char *value = std::getenv(name);
+        if (value && *value) {
+            locale = value;
+            break;
+        }
+    }
+    locale = locale.substr(0, locale.find('@'));
+    if (locale.empty() || locale == "C" || locale == "POSIX" || locale == "C.UTF-8") {
+        return "en_US.UTF-8";
+    }
+    size_t dot = locale.find('.');
+    if (dot != std::string::npos) {
+        std::string codeset = locale.substr(dot + 1);
+        if (codeset == "utf8" || codeset == "UTF8" || codeset == "utf-8") {
+            locale = locale.substr(0, dot) + ".UTF-8";
+        }
+    }
+    return locale;
+}
+
+// System Compose file for the user's locale, looked up in compose.dir
+static std::string systemComposeFile() {
+    std::string dir = localeDir();
+    std::ifstream index(dir + "/compose.dir");
+    std::string locale = localeName();
+    std::string line, fallback;
+    while (std::getline(index, line)) {
+        line = trim(line);
+        size_t colon = line.find(':');
+        if (line.empty() || line[0] == '#' || colon == std::string::npos) {
+            continue;
+        }
+        std::string name = trim(line.substr(colon + 1));
+        if (name == locale) {
+            return dir + "/" + line.substr(0, colon);
+        }
+        if (name == "en_US.UTF-8" && fallback.empty()) {
+            fallback = dir + "/" + line.substr(0, colon);
+        }
+    }
+    return fallback;
+}
+
+// Encodes a code point as UTF-8
+static void appendUtf8(std::string &text, unsigned long code) {
+    if (code < 0x80) {
+        text += static_cast<char>(code);
+    } else if (code < 0x800) {
+        text += static_cast<char>(0xC0 | (code >> 6));
+        text += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        text += static_cast<char>(0xE0 | (code >> 12));
+        text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        text += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        text += static_cast<char>(0xF0 | (code >> 18));
+        text += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        text += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+// Parses a quoted result with the escapes Compose(5) allows: \\ \" \ooo \xhh
+static bool parseString(const std::string &text, size_t &pos, std::string &out) {
+    pos++;  // Opening quote
+    while (pos < text.size() && text[pos] != '"') {
+        char c = text[pos++];
+        if (c != '\\' || pos >= text.size()) {
+            out += c;
+            continue;
+        }
+        c = text[pos];
+        if (c == 'x' || c == 'X') {
+            size_t end = pos + 1;
+            while (end < text.size() && end < pos + 3 && std::isxdigit(static_cast<unsigned char>(text[end]))) {
+                end++;
+            }
+            out += static_cast<char>(std::strtoul(text.substr(pos + 1, end - pos - 1).c_str(), nullptr, 16));
+            pos = end;
+        } else if (c >= '0' && c <= '7') {
+            size_t end = pos;
+            while (end < text.size() && end < pos + 3 && text[end] >= '0' && text[end] <= '7') {
+                end++;
+            }
+            out += static_cast<char>(std::strtoul(text.substr(pos, end - pos).c_str(), nullptr, 8));
+            pos = end;
+        } else {
+            out += c;  // \\ and \" and anything else stand for themselves
+            pos++;
+        }
+    }
+    if (pos >= text.size()) {
+        return false;
+    }
+    pos++;  // Closing quote
+    return true;
+}
+
+ComposeTable::ComposeTable() : edges(64), results(1, 0), pool(1, '\0') {}
+
+const ComposeTable::Edge *ComposeTable::findEdge(uint32_t node, uint32_t keysym) const {
+    size_t mask = edges.size() - 1;
+    for (size_t slot = edgeHash(node, keysym) & mask;; slot = (slot + 1) & mask) {
+        const Edge &edge = edges[slot];
+        if (edge.child == 0) {
+            return nullptr;
+        }
+        if (edge.node == node && edge.keysym == keysym) {
+            return &edge;
+        }
+    }
+}
+
+uint32_t ComposeTable::step(uint32_t node, unsigned long keysym) const {
+    const Edge *edge = findEdge(node, static_cast<uint32_t>(keysym));
+    return edge ? edge->child : ROOT;
+}
+
+void ComposeTable::growEdges() {
+    std::vector<Edge> old(edges.size() * 2);
+    old.swap(edges);
+    size_t mask = edges.size() - 1;
+    for (const Edge &edge : old) {
+        if (edge.child == 0) {
+            continue;
+        }
+        size_t slot = edgeHash(edge.node, edge.keysym) & mask;
+        while (edges[slot].child != 0) {
+            slot = (slot + 1) & mask;
+        }
+        edges[slot] = edge;
+    }
+}
+
+uint32_t ComposeTable::addEdge(uint32_t node, uint32_t keysym) {
+    const Edge *existing = findEdge(node, keysym);
+    if (existing) {
+        return existing->child;
+    }
+    if ((edgeCount + 1) * 2 > edges.size()) {
+        growEdges();
+    }
+    size_t mask = edges.size() - 1;
+    size_t slot = edgeHash(node, keysym) & mask;
+    while (edges[slot].child != 0) {
+        slot = (slot + 1) & mask;
+    }
+    uint32_t child = results.size();
+    results.push_back(0);
+    edges[slot] = {node, keysym, child};
+    edgeCount++;
+    return child;
+}
+
+size_t ComposeTable::memoryBytes() const {
+    return edges.capacity() * sizeof(Edge) + results.capacity() * sizeof(uint32_t) + pool.capacity();
+}
+
+bool ComposeTable::loadDefault() {
+    const char *file = std::getenv("XCOMPOSEFILE");
+    if (file && *file) {
+        return loadFile(file);
+    }
+    const char *home = std::getenv("HOME");
+    if (home && *home) {
+        std::string user = std::string(home) + "/.XCompose";
+        if (std::ifstream(user)) {
+            return loadFile(user);
+        }
+    }
+    std::string system = systemComposeFile();
+    if (system.empty()) {
+        std::cerr << "No Compose file for locale " << localeName() << " in " << localeDir() << std::endl;
+        return false;
+    }
+    return loadFile(system);
+}
+
+bool ComposeTable::loadFile(const std::string &path) {
+    return loadFile(path, 0);
+}
+
+bool ComposeTable::loadFile(const std::string &path, int depth) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open Compose file " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::string error;
+        if (!addLine(line, error, depth) && !error.empty()) {
+            std::cerr << path << ":" << lineNumber << ": " << error << std::endl;
+        }
+    }
+    return true;
+}
+
+// Adds one "<a> <b> : "text" keysym" line; false with an empty error for lines
+// that are skipped on purpose (comments, modifier-qualified sequences)
+bool ComposeTable::addLine(const std::string &rawLine, std::string &error, int depth) {
+    std::string line = trim(rawLine);
+    if (line.empty() || line[0] == '#') {
+        return false;
+    }
+
+    if (line.compare(0, 7, "include") == 0) {
+        size_t quote = line.find('"');
+        std::string target;
+        if (quote == std::string::npos || !parseString(line, quote, target)) {
+            error = "expected include \"FILE\"";
+            return false;
+        }
+        std::string expanded;
+        for (size_t i = 0; i < target.size(); i++) {
+            if (target[i] != '%' || i + 1 >= target.size()) {
+                expanded += target[i];
+                continue;
+            }
+            char code = target[++i];
+            if (code == 'L') {
+                expanded += systemComposeFile();
+            } else if (code == 'S') {
+                expanded += localeDir();
+            } else if (code == 'H') {
+                const char *home = std::getenv("HOME");
+                expanded += home ? home : "";
+            } else {
+                expanded += code;
+            }
+        }
+        if (depth >= MAX_INCLUDE_DEPTH) {
+            error = "includes nested too deep";
+            return false;
+        }
+        return loadFile(expanded, depth + 1);
+    }
+
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+        error = "expected '<keys> : \"text\"'";
+        return false;
+    }
+
+    // Left side: keysym names in angle brackets
+    std::vector<uint32_t> keysyms;
+    size_t pos = 0;
+    while ((pos = line.find_first_not_of(" \t", pos)) < colon) {
+        if (line[pos] != '<') {
+            return false;  // "!Ctrl <a>" or "None <a>": needs modifier state we don't track
+        }
+        size_t close = line.find('>', pos);
+        if (close == std::string::npos || close > colon) {
+            error = "unterminated <key>";
+            return false;
+        }
+        std::string name = line.substr(pos + 1, close - pos - 1);
+        KeySym keysym = XStringToKeysym(name.c_str());
+        if (keysym == NoSymbol) {
+            error = "unknown keysym '" + name + "'";
+            return false;
+        }
+        keysyms.push_back(static_cast<uint32_t>(keysym));
+        pos = close + 1;
+    }
+    if (keysyms.empty()) {
+        error = "empty sequence";
+        return false;
+    }
+
+    // Right side: a quoted string, or only a keysym standing for its character
+    std::string text;
+    pos = line.find_first_not_of(" \t", colon + 1);
+    if (pos != std::string::npos && line[pos] == '"') {
+        if (!parseString(line, pos, text)) {
+            error = "unterminated string";
+            return false;
+        }
+    } else if (pos != std::string::npos) {
+        std::string name = line.substr(pos, line.find_first_of(" \t#", pos) - pos);
+        KeySym keysym = XStringToKeysym(name.c_str());
+        if ((keysym & 0xFF000000UL) == 0x01000000UL) {
+            appendUtf8(text, keysym & 0xFFFFFF);  // Unicode keysym
+        } else if ((keysym >= 0x20 && keysym < 0x7F) || (keysym >= 0xA0 && keysym <= 0xFF)) {
+            appendUtf8(text, keysym);  // Latin-1 keysyms equal their code point
+        } else {
+            text = name;
+        }
+    }
+    if (text.empty()) {
+        error = "missing result";
+        return false;
+    }
+
+    uint32_t node = ROOT;
+    for (uint32_t keysym : keysyms) {
+        node = addEdge(node, keysym);
+    }
+    if (results[node] == 0) {
+        sequenceCount++;
+    }
+    results[node] = pool.size();  // A later definition overrides an earlier one
+    pool += text;
+    pool += '\0';
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef COMPOSETABLE_H
+#define COMPOSETABLE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Dead-key and Multi_key sequences from an X Compose file, e.g.
+//   <dead_acute> <e> : "é" eacute
+// compiled into a trie whose edges live in one open-addressed table keyed by
+// (node, keysym). The table is immutable once loaded and holds no resolver
+// state, so several ScreenKey instances can share it; each keeps its own node.
+class ComposeTable {
+public:
+    static const uint32_t ROOT = 0;
+
+    ComposeTable();
+
+    // Loads $XCOMPOSEFILE, else ~/.XCompose, else the system file of the user's locale
+    bool loadDefault();
+
+    // Loads one Compose file, following its include lines
+    bool loadFile(const std::string &path);
+
+    // Follows `keysym` from `node`: the child node, or ROOT when no sequence
+    // continues that way. The edge table is at most half full, so this is O(1)
+    // whatever the size of the Compose file.
+    uint32_t step(uint32_t node, unsigned long keysym) const;
+
+    // UTF-8 text a complete sequence produces, nullptr while it is still a prefix
+    const char *result(uint32_t node) const {
+        return results[node] ? pool.data() + results[node] : nullptr;
+    }
+
+    size_t size() const { return sequenceCount; }
+    size_t memoryBytes() const;
+
+private:
+    struct Edge {
+        uint32_t node;
+        uint32_t keysym;
+        uint32_t child;  // 0 marks an empty slot, the root is never a child
+    };
+
+    static size_t edgeHash(uint32_t node, uint32_t keysym) {
+        uint64_t key = (static_cast<uint64_t>(node) << 32) | keysym;
+        return (key * 0x9E3779B97F4A7C15ULL) >> 32;
+    }
+
+    const Edge *findEdge(uint32_t node, uint32_t keysym) const;
+    uint32_t addEdge(uint32_t node, uint32_t keysym);
+    void growEdges();
+    bool loadFile(const std::string &path, int depth);
+    bool addLine(const std::string &line, std::string &error, int depth);
+
+    std::vector<Edge> edges;  // Power-of-two slots, at most half used
+    size_t edgeCount = 0;
+    std::vector<uint32_t> results;  // Per node: offset into pool, 0 when not terminal
+    std::string pool;  // NUL-terminated results; starts with a NUL so offset 0 means none
+    size_t sequenceCount = 0;
+};
+
+#endif
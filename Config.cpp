@@ -0,0 +1,255 @@
+#include "Config.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <X11/Xlib.h>
+
+static std::string trim(const std::string &text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+// "button1".."button9" or a keysym name; false when it is neither
+static bool parseKey(const std::string &name, unsigned long &key) {
+    if (name.size() == 7 && name.compare(0, 6, "button") == 0 && name[6] >= '1' && name[6] <= '9') {
+        key = name[6] - '0';
+        return true;
+    }
+    key = XStringToKeysym(name.c_str());
+    return key != NoSymbol;
+}
+
+static bool parseColor(const std::string &name, short &color) {
+    static const char *names[] = {"black", "red", "green", "yellow", "blue", "magenta", "cyan", "white"};
+    for (short i = 0; i < 8; i++) {
+        if (name == names[i]) {
+            color = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Config::load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open config file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;  // As in the sequence file; a label or color may contain '#'
+        }
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            std::cerr << path << ":" << lineNumber << ": expected 'NAME = VALUE'" << std::endl;
+            continue;
+        }
+        std::string name = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+
+        std::string error;
+        unsigned long key;
+        if (name.compare(0, 6, "label.") == 0) {
+            if (parseKey(name.substr(6), key)) {
+                labels.emplace_back(key, value);
+            } else {
+                error = "unknown key '" + name.substr(6) + "'";
+            }
+        } else if (name == "hide") {
+            std::istringstream keys(value);
+            std::string token;
+            while (keys >> token) {
+                if (parseKey(token, key)) {
+                    labels.emplace_back(key, "");
+                } else {
+                    error = "unknown key '" + token + "'";
+                }
+            }
+        } else if (name == "linger") {
+            lingerMs = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (name == "frame-cap") {
+            frameCap = std::atoi(value.c_str());
+        } else if (name == "renderer") {
+            if (value == "ncurses" || value == "ansi" || value == "none") {
+                renderer = value;
+            } else {
+                error = "unknown renderer '" + value + "'";
+            }
+        } else if (name == "foreground" || name == "background") {
+            if (!parseColor(value, name == "foreground" ? foreground : background)) {
+                error = "unknown color '" + value + "'";
+            }
+        } else if (name == "private") {
+            if (!value.empty()) {
+                privacyRules.push_back(value);
+            }
+        } else {
+            error = "unknown setting '" + name + "'";
+        }
+        if (!error.empty()) {
+            std::cerr << path << ":" << lineNumber << ": " << error << std::endl;
+        }
+    }
+
+    // Flat table sorted by key; the last definition of a key wins
+    std::stable_sort(labels.begin(), labels.end(),
+                     [](const std::pair<unsigned long, std::string> &a,
+                        const std::pair<unsigned long, std::string> &b) { return a.first < b.first; });
+    std::vector<std::pair<unsigned long, std::string>> unique;
+    for (auto &label : labels) {
+        if (!unique.empty() && unique.back().first == label.first) {
+            unique.back().second = std::move(label.second);
+        } else {
+            unique.push_back(std::move(label));
+        }
+    }
+    labels.swap(unique);
+    return true;
+}
+
+ConfigStore::~ConfigStore() {
+    stopWatching();
+    delete config.load();
+    for (const Config *old : retired) {
+        delete old;
+    }
+}
+
+bool ConfigStore::load(const std::string &path) {
+    configPath = path;
+    return reload();
+}
+
+bool ConfigStore::reload() {
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    Config *next = new Config();
+    if (!next->load(configPath)) {
+        delete next;
+        return false;
+    }
+
+    const Config *previous = config.load(std::memory_order_relaxed);
+    next->generation = previous ? previous->generation + 1 : 1;
+    config.store(next, std::memory_order_release);
+    publishedGeneration.store(next->generation, std::memory_order_release);
+    if (previous) {
+        retired.push_back(previous);
+    }
+
+    // A Config is unreachable once the reader went quiescent after its successor was published
+    unsigned long seen = readerGeneration.load(std::memory_order_acquire);
+    auto reachable = std::remove_if(retired.begin(), retired.end(), [seen](const Config *old) {
+        if (old->generation < seen) {
+            delete old;
+            return true;
+        }
+        return false;
+    });
+    retired.erase(reachable, retired.end());
+    return true;
+}
+
+bool ConfigStore::startWatching() {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        std::cerr << "Cannot watch config file: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Watch the directory: editors often save by writing a new file and renaming it over the old one.
+    // Not IN_CREATE: a file just created is still empty, and loading it would drop every private rule.
+    size_t slash = configPath.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : configPath.substr(0, slash + 1);
+    if (inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "Cannot watch " << directory << ": " << std::strerror(errno) << std::endl;
+        ::close(inotifyFd);
+        inotifyFd = -1;
+        return false;
+    }
+
+    if (pipe2(wakeFds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        std::cerr << "Cannot create pipe: " << std::strerror(errno) << std::endl;
+        ::close(inotifyFd);
+        inotifyFd = -1;
+        return false;
+    }
+
+    watching = true;
+    watcher = std::thread(&ConfigStore::watch, this);
+    return true;
+}
+
+void ConfigStore::stopWatching() {
+    watching = false;
+    if (watcher.joinable()) {
+        watcher.join();
+    }
+    if (inotifyFd >= 0) {
+        ::close(inotifyFd);
+        inotifyFd = -1;
+    }
+    for (int &fd : wakeFds) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
+
+bool ConfigStore::requestReload() {
+    if (!watching) {
+        return false;
+    }
+    char wake = 1;
+    return write(wakeFds[1], &wake, 1) == 1 || errno == EAGAIN;  // A full pipe already has a reload pending
+}
+
+void ConfigStore::watch() {
+    size_t slash = configPath.rfind('/');
+    std::string fileName = slash == std::string::npos ? configPath : configPath.substr(slash + 1);
+
+    alignas(inotify_event) char buffer[4096];
+    while (watching) {
+        pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+        if (poll(fds, 2, 100) <= 0) {
+            continue;  // Timeout, so stopWatching() is noticed
+        }
+
+        bool changed = false;
+        char wake[64];
+        while (read(wakeFds[0], wake, sizeof(wake)) > 0) {
+            changed = true;
+        }
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char *p = buffer; p < buffer + length;) {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(p);
+                if (event->len > 0 && fileName == event->name) {
+                    changed = true;
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (changed) {
+            reload();
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+
+// Front end settings read from a file of "name = value" lines; lines starting
+// with '#' are comments:
+//
+//   # keysym name, or button1..button9; hide = never shown
+//   label.Left = ←
+//   hide = Shift_L button3
+//   # ms the last keys stay up after release, 0 keeps them
+//   linger = 2000
+//   # terminal redraws per second at most (default), 0 draws as soon as it can
+//   frame-cap = 30
+//   # or ansi, or none; ncurses and ansi only take effect at startup
+//   renderer = ncurses
+//   # black red green yellow blue magenta cyan white
+//   foreground = yellow
+//   background = black
+//   # hide keys typed in matching windows, one rule per line
+//   private = class:KeePassXC
+//
+// Parsed once into a Config that is never modified afterwards.
+struct Config {
+    unsigned long generation = 0;  // Increases with every reload
+    std::vector<std::pair<unsigned long, std::string>> labels;  // Keysym or button -> label, "" hides it
+    unsigned long lingerMs = 0;
+    int frameCap = 30;
+    std::string renderer;  // "" leaves the renderer chosen at startup
+    short foreground = 7;  // ncurses color numbers (COLOR_WHITE)
+    short background = 0;  // COLOR_BLACK
+    std::vector<std::string> privacyRules;  // See ScreenKey::setPrivacyRules()
+
+    // Parses `path`; bad lines are reported and skipped. False if it can't be read.
+    bool load(const std::string &path);
+};
+
+// Holds the current Config and swaps in a new one when the file changes, RCU
+// style: a watcher thread parses the file and publishes it with one atomic
+// pointer store, so the capture thread never waits for a reload. The previous
+// Config is freed once the reader has passed a quiescent point, i.e. no longer
+// holds a pointer into it; retired Configs are freed on the next reload.
+class ConfigStore {
+public:
+    ~ConfigStore();
+
+    // Loads `path` for the first time, synchronously
+    bool load(const std::string &path);
+
+    // Watches the file with inotify and reloads it whenever it is written or replaced
+    bool startWatching();
+    void stopWatching();
+
+    // Parses the file again and publishes it; the current Config stays if the file can't be read
+    bool reload();
+
+    // Asks the watcher thread to reload, so the caller doesn't wait for the parse;
+    // false when nothing is being watched
+    bool requestReload();
+
+    // Reader side, for one reader thread: current() is valid until the next
+    // quiescent() call, which the reader makes whenever it holds no Config pointer
+    const Config *current() const { return config.load(std::memory_order_acquire); }
+    void quiescent() {
+        readerGeneration.store(publishedGeneration.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    const std::string &path() const { return configPath; }
+
+private:
+    void watch();
+
+    std::string configPath;
+    std::atomic<const Config *> config{nullptr};
+    std::atomic<unsigned long> publishedGeneration{0};
+    std::atomic<unsigned long> readerGeneration{0};
+    std::mutex reloadMutex;  // Only serialises reloads with each other
+    std::vector<const Config *> retired;  // Replaced, freed once the reader has moved past them
+    std::thread watcher;
+    std::atomic<bool> watching{false};
+    int inotifyFd = -1;
+    int wakeFds[2] = {-1, -1};  // Pipe that wakes the watcher for requestReload()
+};
+
+#endif
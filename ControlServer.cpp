@@ -0,0 +1,202 @@
+#include "ControlServer.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+static bool makeAddress(const std::string &path, sockaddr_un &address) {
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+bool removeStaleSocket(const std::string &path) {
+    struct stat info;
+    if (lstat(path.c_str(), &info) < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        std::cerr << "Cannot use " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (!S_ISSOCK(info.st_mode)) {
+        std::cerr << "Not replacing " << path << ": it exists and is not a socket" << std::endl;
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+ControlServer::~ControlServer() {
+    for (Client &client : clients) {
+        close(client.fd);
+    }
+    if (listener >= 0) {
+        close(listener);
+        unlink(socketPath.c_str());
+    }
+}
+
+bool ControlServer::listen(const std::string &path) {
+    sockaddr_un address;
+    if (!makeAddress(path, address)) {
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    if (!removeStaleSocket(path)) {
+        close(fd);
+        return false;
+    }
+
+    // Commands control what is shown; the socket is created owner-only so no
+    // other user can connect, not even before a chmod() would get to it
+    mode_t oldMask = umask(077);
+    int bound = bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+    int bindError = errno;
+    umask(oldMask);
+    if (bound < 0 || ::listen(fd, 4) < 0) {
+        std::cerr << "Cannot listen on " << path << ": " << std::strerror(bound < 0 ? bindError : errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    listener = fd;
+    socketPath = path;
+    return true;
+}
+
+void ControlServer::addPollFds(std::vector<pollfd> &fds) const {
+    if (listener >= 0) {
+        fds.push_back({listener, POLLIN, 0});
+    }
+    for (const Client &client : clients) {
+        fds.push_back({client.fd, POLLIN, 0});
+    }
+}
+
+void ControlServer::handlePollFds(const pollfd *fds, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!fds[i].revents) {
+            continue;
+        }
+        if (fds[i].fd == listener) {
+            acceptClients();
+            continue;
+        }
+
+        // Matched by value, the list may have changed since addPollFds()
+        for (size_t c = 0; c < clients.size(); c++) {
+            if (clients[c].fd == fds[i].fd) {
+                if ((fds[i].revents & (POLLERR | POLLNVAL)) || !readCommands(clients[c])) {
+                    closeClient(c);
+                }
+                break;
+            }
+        }
+    }
+}
+
+void ControlServer::acceptClients() {
+    while (true) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        clients.push_back({fd, {}});
+    }
+}
+
+// Runs every complete line; false when the client is gone or misbehaves
+bool ControlServer::readCommands(Client &client) {
+    char buffer[256];
+    while (true) {
+        ssize_t n = read(client.fd, buffer, sizeof(buffer));
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        client.input.append(buffer, n);
+
+        size_t newline;
+        while ((newline = client.input.find('\n')) != std::string::npos) {
+            std::string command = client.input.substr(0, newline);
+            client.input.erase(0, newline + 1);
+            if (!command.empty() && command.back() == '\r') {
+                command.pop_back();
+            }
+
+            std::string reply = handler ? handler(command) : "error: no handler";
+            reply += '\n';
+            // Replies are a few bytes into an empty socket buffer; a client
+            // that doesn't read them is dropped rather than waited for
+            if (send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(reply.size())) {
+                return false;
+            }
+        }
+        if (client.input.size() > MAX_LINE) {
+            return false;
+        }
+    }
+}
+
+void ControlServer::closeClient(size_t index) {
+    close(clients[index].fd);
+    clients.erase(clients.begin() + index);
+}
+
+std::string defaultControlPath() {
+    const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        return std::string(runtime) + "/cscreenkey.sock";
+    }
+    return "/tmp/cscreenkey-" + std::to_string(getuid()) + ".sock";
+}
+
+bool sendControlCommand(const std::string &path, const std::string &command, std::string &reply) {
+    sockaddr_un address;
+    if (!makeAddress(path, address)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+        std::cerr << "Cannot connect to " << path << ": " << std::strerror(errno) << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    std::string line = command + "\n";
+    if (send(fd, line.data(), line.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(line.size())) {
+        std::cerr << "Cannot send to " << path << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    reply.clear();
+    char c;
+    while (read(fd, &c, 1) == 1 && c != '\n') {
+        reply += c;
+    }
+    close(fd);
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <poll.h>
+
+// Accepts one-line commands ("pause", "clear", ...) on a Unix domain socket and
+// answers each with one reply line from the handler. Polled from the capture
+// loop like EventServer: sockets are non-blocking, so a silent or slow client
+// never holds up capture, and the handler runs on the capture thread.
+class ControlServer {
+public:
+    using Handler = std::function<std::string(const std::string &command)>;
+    static const size_t MAX_LINE = 1024;
+
+    ~ControlServer();
+
+    bool listen(const std::string &path);
+    void setHandler(Handler callback) { handler = std::move(callback); }
+
+    // Adds the descriptors the capture loop has to poll for us
+    void addPollFds(std::vector<pollfd> &fds) const;
+
+    // Handles readiness reported by poll() for the descriptors added above
+    void handlePollFds(const pollfd *fds, size_t count);
+
+private:
+    struct Client {
+        int fd;
+        std::string input;  // Bytes of a command line not terminated yet
+    };
+
+    void acceptClients();
+    bool readCommands(Client &client);
+    void closeClient(size_t index);
+
+    int listener = -1;
+    std::vector<Client> clients;
+    std::string socketPath;
+    Handler handler;
+};
+
+// Removes a socket left behind at `path` by a previous run before it is bound
+// again; anything else at that path is left alone and reported, false then.
+// EventServer uses it for its Unix socket too.
+bool removeStaleSocket(const std::string &path);
+
+// $XDG_RUNTIME_DIR/cscreenkey.sock, or /tmp/cscreenkey-UID.sock without a runtime directory
+std::string defaultControlPath();
+
+// Sends `command` to the control socket at `path` and reads the reply line;
+// false when the daemon can't be reached
+bool sendControlCommand(const std::string &path, const std::string &command, std::string &reply);
+
+#endif
@@ -0,0 +1,240 @@
+#include "EventServer.h"
+#include "ControlServer.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static void appendJsonString(std::string &out, const char *text) {
+    out += '"';
+    for (const char *c = text; *c; c++) {
+        unsigned char ch = *c;
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if (ch < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+            out += escaped;
+        } else {
+            out += ch;
+        }
+    }
+    out += '"';
+}
+
+std::string formatEventJson(const KeyEvent &event) {
+    std::string line = "{\"type\":\"";
+    line += keyEventTypeName(event.type);
+    line += "\",\"time\":" + std::to_string(event.time);
+    line += ",\"detail\":" + std::to_string(event.detail);
+    line += ",\"label\":";
+    appendJsonString(line, event.label);
+    line += ",\"combination\":";
+    appendJsonString(line, event.combination);
+    line += ",\"source\":";
+    appendJsonString(line, event.source);
+    line += ",\"device\":";
+    appendJsonString(line, event.device);
+    line += "}\n";
+    return line;
+}
+
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+EventServer::~EventServer() {
+    for (int fd : listeners) {
+        close(fd);
+    }
+    for (Client &client : clients) {
+        close(client.fd);
+    }
+    if (!unixPath.empty()) {
+        unlink(unixPath.c_str());
+    }
+}
+
+bool EventServer::listenUnix(const std::string &path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    if (!removeStaleSocket(path)) {
+        close(fd);
+        return false;
+    }
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(fd, 8) < 0 || !setNonBlocking(fd)) {
+        std::cerr << "Cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    listeners.push_back(fd);
+    unixPath = path;
+    return true;
+}
+
+bool EventServer::listenTcp(int port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Never exposed beyond this machine
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(fd, 8) < 0 || !setNonBlocking(fd)) {
+        std::cerr << "Cannot listen on 127.0.0.1:" << port << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    listeners.push_back(fd);
+    return true;
+}
+
+void EventServer::addPollFds(std::vector<pollfd> &fds) const {
+    for (int fd : listeners) {
+        fds.push_back({fd, POLLIN, 0});
+    }
+    for (const Client &client : clients) {
+        short events = POLLIN;
+        if (client.sent < client.backlog.size()) {
+            events |= POLLOUT;
+        }
+        fds.push_back({client.fd, events, 0});
+    }
+}
+
+void EventServer::handlePollFds(const pollfd *fds, size_t count) {
+    // Client descriptors are matched by value because the list may have
+    // changed since addPollFds() was called
+    for (size_t i = 0; i < count; i++) {
+        if (!fds[i].revents) {
+            continue;
+        }
+
+        bool isListener = false;
+        for (int listener : listeners) {
+            if (fds[i].fd == listener) {
+                acceptClients(listener);
+                isListener = true;
+            }
+        }
+        if (isListener) {
+            continue;
+        }
+
+        for (size_t c = 0; c < clients.size(); c++) {
+            if (clients[c].fd != fds[i].fd) {
+                continue;
+            }
+
+            if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                closeClient(c);
+            } else if (fds[i].revents & POLLIN) {
+                // Subscribers have nothing to say; drain input and notice EOF
+                char discard[256];
+                ssize_t n = read(clients[c].fd, discard, sizeof(discard));
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                    closeClient(c);
+                    break;
+                }
+            }
+            if (c < clients.size() && clients[c].fd == fds[i].fd && (fds[i].revents & POLLOUT)) {
+                flush(clients[c]);
+            }
+            break;
+        }
+    }
+}
+
+void EventServer::acceptClients(int listener) {
+    while (true) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        clients.push_back({fd, {}, 0});
+        Client &client = clients.back();
+        client.backlog.reserve(MAX_BACKLOG);
+        if (!lastState.empty()) {
+            queue(client, lastState.data(), lastState.size());
+            flush(client);
+        }
+    }
+}
+
+void EventServer::queue(Client &client, const char *data, size_t size) {
+    if (client.sent > 0) {
+        // Compact instead of growing, the reserved capacity is the client's budget
+        client.backlog.erase(client.backlog.begin(), client.backlog.begin() + client.sent);
+        client.sent = 0;
+    }
+    client.backlog.insert(client.backlog.end(), data, data + size);
+}
+
+void EventServer::flush(Client &client) {
+    while (client.sent < client.backlog.size()) {
+        ssize_t n = send(client.fd, client.backlog.data() + client.sent,
+                         client.backlog.size() - client.sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            break;  // EAGAIN: the rest goes out when poll() reports POLLOUT
+        }
+        client.sent += n;
+    }
+    if (client.sent == client.backlog.size()) {
+        client.backlog.clear();
+        client.sent = 0;
+    }
+}
+
+void EventServer::closeClient(size_t index) {
+    close(clients[index].fd);
+    clients.erase(clients.begin() + index);
+}
+
+void EventServer::publish(const KeyEvent &event) {
+    lastState = formatEventJson(event);
+
+    for (size_t i = 0; i < clients.size();) {
+        Client &client = clients[i];
+        if (client.backlog.size() - client.sent + lastState.size() > MAX_BACKLOG) {
+            closeClient(i);  // Too slow, drop it rather than wait
+            dropped++;
+            continue;
+        }
+
+        queue(client, lastState.data(), lastState.size());
+        flush(client);
+        i++;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef EVENTSERVER_H
+#define EVENTSERVER_H
+
+#include "KeyEvent.h"
+
+#include <string>
+#include <vector>
+#include <poll.h>
+
+// Pushes every KeyEvent as one line of JSON to any number of local subscribers
+// on a Unix domain socket and, optionally, a localhost TCP port. Sockets are
+// non-blocking and each client gets a bounded backlog; a client that falls
+// further behind is disconnected instead of stalling the capture loop.
+class EventServer {
+public:
+    static const size_t MAX_BACKLOG = 64 * 1024;
+
+    ~EventServer();
+
+    bool listenUnix(const std::string &path);
+    bool listenTcp(int port);
+
+    // Adds the descriptors the capture loop has to poll for us
+    void addPollFds(std::vector<pollfd> &fds) const;
+
+    // Handles readiness reported by poll() for the descriptors added above
+    void handlePollFds(const pollfd *fds, size_t count);
+
+    void publish(const KeyEvent &event);
+
+    size_t clientCount() const { return clients.size(); }
+    unsigned long droppedClients() const { return dropped; }
+
+private:
+    struct Client {
+        int fd;
+        std::vector<char> backlog;  // Reserved to MAX_BACKLOG on connect, never grown
+        size_t sent = 0;            // Bytes of backlog already written
+    };
+
+    void acceptClients(int listener);
+    void flush(Client &client);
+    void queue(Client &client, const char *data, size_t size);
+    void closeClient(size_t index);
+
+    std::vector<int> listeners;
+    std::vector<Client> clients;
+    std::string unixPath;
+    std::string lastState;  // Newest event line, sent to clients when they connect
+    unsigned long dropped = 0;
+};
+
+// Formats an event as a single line of JSON terminated by '\n'
+std::string formatEventJson(const KeyEvent &event);
+
+#endif
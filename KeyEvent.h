@@ -0,0 +1,68 @@
+#ifndef KEYEVENT_H
+#define KEYEVENT_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+enum KeyEventType : uint32_t {
+    KEY_EVENT_PRESS = 1,
+    KEY_EVENT_RELEASE = 2,
+    KEY_EVENT_BUTTON_PRESS = 3,
+    KEY_EVENT_BUTTON_RELEASE = 4,
+    KEY_EVENT_RESYNC = 5,  // Pressed state corrected without an input event
+    KEY_EVENT_DRAG = 6,    // A held button moved past the drag threshold
+    KEY_EVENT_SCROLL = 7,  // Wheel or touchpad scrolling, accumulated; detail is button 4-7
+    KEY_EVENT_TOUCH = 8,   // Touch gesture recognised or changed; detail is the finger count
+    KEY_EVENT_TOUCH_END = 9
+};
+
+// One capture event together with the resulting pressed state. The record is
+// plain fixed-size data so it can be copied into sockets and shared memory as is.
+struct KeyEvent {
+    uint64_t time;           // X server time in milliseconds
+    uint32_t type;           // KeyEventType
+    uint32_t detail;         // Keycode or mouse button
+    char label[64];          // Name of the key or button, as displayed
+    char combination[192];   // Every key held after the event, "" when none
+    char source[32];         // Display the event came from, e.g. ":1"
+    char device[64];         // Physical device that sent it, "" when unknown
+};
+
+// Copies at most `size - 1` bytes of `text` and terminates it; text that
+// doesn't fit is cut before a UTF-8 character, never inside one
+inline void copyEventText(char *destination, size_t size, const char *text, size_t length) {
+    if (length > size - 1) {
+        length = size - 1;
+        while (length > 0 && (static_cast<unsigned char>(text[length]) & 0xC0) == 0x80) {
+            length--;
+        }
+    }
+    std::memcpy(destination, text, length);
+    destination[length] = '\0';
+}
+
+inline void copyEventText(char *destination, size_t size, const std::string &text) {
+    copyEventText(destination, size, text.data(), text.size());
+}
+
+inline void copyEventText(char *destination, size_t size, const char *text) {
+    copyEventText(destination, size, text, strnlen(text, size));
+}
+
+inline const char *keyEventTypeName(uint32_t type) {
+    switch (type) {
+        case KEY_EVENT_PRESS: return "press";
+        case KEY_EVENT_RELEASE: return "release";
+        case KEY_EVENT_BUTTON_PRESS: return "button_press";
+        case KEY_EVENT_BUTTON_RELEASE: return "button_release";
+        case KEY_EVENT_RESYNC: return "resync";
+        case KEY_EVENT_DRAG: return "drag";
+        case KEY_EVENT_SCROLL: return "scroll";
+        case KEY_EVENT_TOUCH: return "touch";
+        case KEY_EVENT_TOUCH_END: return "touch_end";
+    }
+    return "unknown";
+}
+
+#endif
@@ -0,0 +1,303 @@
+#include "KeySequence.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+#include <algorithm>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+
+static std::string lowercase(const std::string &text) {
+    std::string result;
+    for (char c : text) {
+        result += std::tolower(static_cast<unsigned char>(c));
+    }
+    return result;
+}
+
+static std::string trim(const std::string &text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+// Splits "KEYS = VALUE" at the first " = ", so the value may contain '=' and
+// the key may be '=' itself ("Ctrl+= = Zoom in"); without spaces, at the first '='
+static bool splitAssignment(const std::string &line, std::string &keys, std::string &value) {
+    size_t equals = line.find(" = ");
+    size_t skip = 3;
+    if (equals == std::string::npos) {
+        equals = line.find('=');
+        skip = 1;
+    }
+    if (equals == std::string::npos) {
+        return false;
+    }
+    keys = trim(line.substr(0, equals));
+    value = trim(line.substr(equals + skip));
+    return true;
+}
+
+bool parseChord(const std::string &text, uint64_t &chord) {
+    unsigned int mods = 0;
+    std::string rest = text;
+
+    // Every '+'-separated token before the last one is a modifier ("Ctrl+Shift+t");
+    // a trailing '+' is the plus key itself ("Ctrl++")
+    size_t plus;
+    while ((plus = rest.find('+')) != std::string::npos && plus + 1 < rest.size()) {
+        std::string modifier = lowercase(rest.substr(0, plus));
+        if (modifier == "ctrl" || modifier == "control" || modifier == "c") {
+            mods |= CHORD_CTRL;
+        } else if (modifier == "shift" || modifier == "s") {
+            mods |= CHORD_SHIFT;
+        } else if (modifier == "alt" || modifier == "meta" || modifier == "m") {
+            mods |= CHORD_ALT;
+        } else if (modifier == "super" || modifier == "win") {
+            mods |= CHORD_SUPER;
+        } else {
+            return false;
+        }
+        rest = rest.substr(plus + 1);
+    }
+
+    KeySym keysym;
+    if (rest == "+") {
+        keysym = XK_plus;
+    } else if (rest.size() == 1 && std::isupper(static_cast<unsigned char>(rest[0]))) {
+        // Keys are translated at level 0, so "G" means Shift+g
+        mods |= CHORD_SHIFT;
+        keysym = XStringToKeysym(lowercase(rest).c_str());
+    } else {
+        keysym = XStringToKeysym(rest.c_str());
+    }
+    if (keysym == NoSymbol) {
+        return false;
+    }
+
+    chord = makeChord(mods, keysym);
+    return true;
+}
+
+std::string formatChord(uint64_t chord) {
+    unsigned int mods = chord >> 32;
+    std::string text;
+    if (mods & CHORD_CTRL) text += "Ctrl+";
+    if (mods & CHORD_SHIFT) text += "Shift+";
+    if (mods & CHORD_ALT) text += "Alt+";
+    if (mods & CHORD_SUPER) text += "Super+";
+
+    const char *name = XKeysymToString(chord & 0xFFFFFFFFUL);
+    text += name ? name : "NoSymbol";
+    return text;
+}
+
+SequenceMatcher::SequenceMatcher() : nodes(1) {}
+
+bool SequenceMatcher::addSequence(const std::string &spec, const std::string &name, std::string &error) {
+    // Everything is parsed and checked before the trie changes, so a rejected
+    // sequence leaves no prefix behind
+    std::istringstream tokens(spec);
+    std::string token;
+    std::vector<uint64_t> chords;
+    while (tokens >> token) {
+        uint64_t chord;
+        if (!parseChord(token, chord)) {
+            error = "unknown key '" + token + "'";
+            return false;
+        }
+        chords.push_back(chord);
+    }
+    if (chords.empty()) {
+        error = "empty sequence";
+        return false;
+    }
+
+    // Follow the existing path as far as it goes
+    int node = 0;
+    size_t matched = 0;
+    for (; matched < chords.size(); matched++) {
+        if (nodes[node].command >= 0) {
+            error = "prefix '" + commands[nodes[node].command] + "' would shadow it";
+            return false;
+        }
+        auto edge = edges.find(edgeKey(node, chords[matched]));
+        if (edge == edges.end()) {
+            break;
+        }
+        node = edge->second;
+    }
+    if (matched == chords.size() && (nodes[node].command >= 0 || nodes[node].children > 0)) {
+        error = "conflicts with an existing sequence";
+        return false;
+    }
+
+    for (; matched < chords.size(); matched++) {
+        nodes[node].children++;
+        edges[edgeKey(node, chords[matched])] = nodes.size();
+        node = nodes.size();
+        nodes.emplace_back();
+    }
+
+    nodes[node].command = commands.size();
+    commands.push_back(name);
+    compiled = false;
+    return true;
+}
+
+// Breadth first, so a node's fallback (a strictly shorter suffix) already has
+// all its transitions when the node's own are computed
+void SequenceMatcher::compile() {
+    std::vector<uint64_t> alphabet;
+    for (const auto &edge : edges) {
+        alphabet.push_back(edge.first & CHORD_MASK);
+    }
+    std::sort(alphabet.begin(), alphabet.end());
+    alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+
+    auto next = [this](int node, uint64_t chord) {
+        auto transition = transitions.find(edgeKey(node, chord));
+        return transition != transitions.end() ? transition->second : 0;
+    };
+
+    transitions.clear();
+    std::vector<int> fallback(nodes.size(), 0);
+    std::vector<int> queue(1, 0);
+    for (size_t i = 0; i < queue.size(); i++) {
+        int node = queue[i];
+        for (uint64_t chord : alphabet) {
+            auto edge = edges.find(edgeKey(node, chord));
+            if (edge != edges.end()) {
+                transitions[edgeKey(node, chord)] = edge->second;
+                fallback[edge->second] = node == 0 ? 0 : next(fallback[node], chord);
+                queue.push_back(edge->second);
+            } else if (node != 0) {
+                int target = next(fallback[node], chord);
+                if (target != 0) {
+                    transitions[edgeKey(node, chord)] = target;
+                }
+            }
+        }
+    }
+    compiled = true;
+}
+
+bool SequenceMatcher::loadFile(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open sequence file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;  // Only whole lines are comments, a name may contain '#'
+        }
+
+        std::string keys, name;
+        if (!splitAssignment(line, keys, name)) {
+            std::cerr << path << ":" << lineNumber << ": expected 'KEYS = NAME'" << std::endl;
+            continue;
+        }
+
+        std::string error;
+        if (!addSequence(keys, name, error)) {
+            std::cerr << path << ":" << lineNumber << ": " << error << std::endl;
+        }
+    }
+    return true;
+}
+
+const std::string *SequenceMatcher::advance(uint64_t chord, unsigned long timeMs) {
+    if (state != 0 && timeMs - lastTime > timeoutMs) {
+        state = 0;  // Too slow, the pending sequence is abandoned
+    }
+    lastTime = timeMs;
+    if (!compiled) {
+        compile();
+    }
+
+    // A chord that breaks the pending sequence already leads to the longest
+    // other sequence it continues, or to a new one it starts
+    auto transition = transitions.find(edgeKey(state, chord));
+    if (transition == transitions.end()) {
+        state = 0;
+        return nullptr;
+    }
+
+    const Node &next = nodes[transition->second];
+    if (next.command >= 0) {
+        state = 0;
+        return &commands[next.command];
+    }
+    state = transition->second;
+    return nullptr;
+}
+
+bool ShortcutProfiles::loadFile(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open profile file " << path << std::endl;
+        return false;
+    }
+
+    Profile *profile = nullptr;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;  // Same comment rule as the sequence file
+        }
+        if (line.front() == '[' && line.back() == ']') {
+            std::string name = trim(line.substr(1, line.size() - 2));
+            auto existing = byClass.find(lowercase(name));
+            if (name == "*" && fallback) {
+                profile = fallback;
+            } else if (name != "*" && existing != byClass.end()) {
+                profile = existing->second;  // Continued from an earlier section
+            } else {
+                profiles.emplace_back();
+                profile = &profiles.back();
+                profile->name = name;
+                if (name == "*") {
+                    fallback = profile;
+                } else {
+                    byClass[lowercase(name)] = profile;
+                }
+            }
+            continue;
+        }
+
+        std::string keys, action;
+        uint64_t chord;
+        if (!profile) {
+            std::cerr << path << ":" << lineNumber << ": expected '[WM_CLASS]' first" << std::endl;
+        } else if (!splitAssignment(line, keys, action)) {
+            std::cerr << path << ":" << lineNumber << ": expected 'CHORD = ACTION'" << std::endl;
+        } else if (!parseChord(keys, chord)) {
+            std::cerr << path << ":" << lineNumber << ": unknown key '" << keys << "'" << std::endl;
+        } else {
+            profile->actions[chord] = action;
+        }
+    }
+    return true;
+}
+
+const ShortcutProfiles::Profile *ShortcutProfiles::find(const std::string &instance,
+                                                        const std::string &windowClass) const {
+    auto found = byClass.find(lowercase(instance));
+    if (found == byClass.end()) {
+        found = byClass.find(lowercase(windowClass));
+    }
+    return found != byClass.end() ? found->second : fallback;
+}
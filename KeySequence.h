@@ -0,0 +1,111 @@
+#ifndef KEYSEQUENCE_H
+#define KEYSEQUENCE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <unordered_map>
+
+// Modifier bits carried by a chord (independent of the X modifier mapping)
+enum ChordModifier : unsigned int {
+    CHORD_CTRL  = 1 << 0,
+    CHORD_SHIFT = 1 << 1,
+    CHORD_ALT   = 1 << 2,
+    CHORD_SUPER = 1 << 3
+};
+
+// A chord is the modifier bits plus the non-modifier keysym, packed in one integer
+inline uint64_t makeChord(unsigned int mods, unsigned long keysym) {
+    return (static_cast<uint64_t>(mods & 0xF) << 32) | (keysym & 0xFFFFFFFFUL);
+}
+
+// Parses "Ctrl+x" style text into a chord; returns false on an unknown key name
+bool parseChord(const std::string &text, uint64_t &chord);
+
+// Formats a chord back into "Ctrl+x" style text
+std::string formatChord(uint64_t chord);
+
+// Recognises multi-chord sequences ("Ctrl+x Ctrl+s", "g g") compiled into a trie.
+// Before the next advance() after a change, the trie is turned into a DFA:
+// Aho-Corasick fallbacks give every node a transition for each chord that
+// breaks its pending sequence but continues another, so "g g g d" still
+// completes "g g d". All transitions live in one hash table keyed by
+// (node, chord), so advancing costs one lookup no matter how many sequences
+// are loaded.
+class SequenceMatcher {
+public:
+    SequenceMatcher();
+
+    // Adds a sequence of space-separated chords that completes as `name`
+    bool addSequence(const std::string &spec, const std::string &name, std::string &error);
+
+    // Loads "Ctrl+x Ctrl+s = Save buffer" lines; lines starting with '#' are comments
+    bool loadFile(const std::string &path);
+
+    // Feeds one chord; returns the completed command name or nullptr
+    const std::string *advance(uint64_t chord, unsigned long timeMs);
+
+    void reset() { state = 0; }
+    void setTimeout(unsigned long ms) { timeoutMs = ms; }
+    size_t size() const { return commands.size(); }
+
+private:
+    struct Node {
+        int command = -1;    // index into commands, -1 when the node is not terminal
+        int children = 0;
+    };
+
+    static const uint64_t CHORD_MASK = (static_cast<uint64_t>(1) << 36) - 1;
+
+    static uint64_t edgeKey(int node, uint64_t chord) {
+        return (static_cast<uint64_t>(node) << 36) | chord;
+    }
+
+    void compile();
+
+    std::vector<Node> nodes;                 // nodes[0] is the root
+    std::unordered_map<uint64_t, int> edges; // (node, chord) -> child node, the trie itself
+    std::unordered_map<uint64_t, int> transitions;  // (node, chord) -> next node other than the root
+    bool compiled = true;
+    std::vector<std::string> commands;
+    int state = 0;
+    unsigned long lastTime = 0;
+    unsigned long timeoutMs = 1000;
+};
+
+// What single chords mean in each application, e.g. Ctrl+w is "Window
+// command" in Vim but "Close tab" in a browser. Each profile is a hash table
+// from chord to action name, so annotating a keypress is one lookup in the
+// profile of the focused window.
+class ShortcutProfiles {
+public:
+    struct Profile {
+        std::string name;
+        std::unordered_map<uint64_t, std::string> actions;
+
+        // Action bound to `chord`, nullptr when none
+        const std::string *action(uint64_t chord) const {
+            auto found = actions.find(chord);
+            return found != actions.end() ? &found->second : nullptr;
+        }
+    };
+
+    // Loads profiles headed by the WM_CLASS they apply to, "[*]" for any other window:
+    //   [firefox]
+    //   Ctrl+w = Close tab
+    bool loadFile(const std::string &path);
+
+    // Profile for a window's WM_CLASS instance and class names (case is
+    // ignored), else the "[*]" profile, else nullptr. Pointers stay valid.
+    const Profile *find(const std::string &instance, const std::string &windowClass) const;
+
+    size_t size() const { return profiles.size(); }
+
+private:
+    std::deque<Profile> profiles;  // A deque, so loading more never moves a profile
+    std::unordered_map<std::string, Profile *> byClass;  // Lowercased WM_CLASS name -> profile
+    Profile *fallback = nullptr;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "KeyState.h"
+#include "AllocTracker.h"
+#include "Trace.h"
+
+#include <cctype>
+
+std::string toUppercase(const std::string &text) {
+    std::string uppercase_text;
+    for (char c : text) {
+        uppercase_text += std::toupper(static_cast<unsigned char>(c));
+    }
+    return uppercase_text;
+}
+
+void KeyState::updateKeyCombination() {
+    std::string combination;
+    for (const auto& key : activeKeys) {
+        if (!combination.empty()) {
+            combination += " + ";
+        }
+        combination += key;
+    }
+    if (!combination.empty() && !command.empty()) {
+        combination += "  =>  " + command;
+    }
+    currentCombination = combination;
+}
+
+void KeyState::emit(uint32_t type, uint32_t detail, const std::string &label, unsigned long time,
+                    const char *device) {
+    KeyEvent event;
+    {
+        CSK_ALLOC_SCOPE("updateKeyCombination");
+        CSK_TRACE_SCOPE("updateKeyCombination");
+        updateKeyCombination();
+
+        event.time = time;
+        event.type = type;
+        event.detail = detail;
+        copyEventText(event.label, sizeof(event.label), label);
+        copyEventText(event.combination, sizeof(event.combination), currentCombination);
+        copyEventText(event.source, sizeof(event.source), source);
+        copyEventText(event.device, sizeof(event.device), device);
+    }
+
+    if (listener) {
+        listener(event);
+        return;
+    }
+
+    if (queue.size() >= MAX_QUEUED) {
+        queue.pop_front();  // Nobody is reading; keep the newest events
+    }
+    queue.push_back(event);
+}
+
+bool KeyState::nextEvent(KeyEvent &event) {
+    if (queue.empty()) {
+        return false;
+    }
+    event = queue.front();
+    queue.pop_front();
+    return true;
+}
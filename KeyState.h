@@ -0,0 +1,56 @@
+#ifndef KEYSTATE_H
+#define KEYSTATE_H
+
+#include "KeyEvent.h"
+
+#include <set>
+#include <deque>
+#include <string>
+#include <functional>
+
+// The set of keys and buttons held right now and the combination text built
+// from it. Platform neutral: capture backends add and remove labels, then emit
+// one KeyEvent per change. Events go to the listener when one is set, otherwise
+// they are queued (bounded) for nextEvent().
+class KeyState {
+public:
+    using Listener = std::function<void(const KeyEvent &)>;
+    static const size_t MAX_QUEUED = 1024;
+
+    void setListener(Listener callback) { listener = std::move(callback); }
+
+    void add(const std::string &label) { activeKeys.insert(label); }
+    void remove(const std::string &label) { activeKeys.erase(label); }
+    void clear() { activeKeys.clear(); }
+
+    // Name of the key sequence completed by the last keypress, "" for none
+    void setCommand(const std::string &name) { command = name; }
+
+    // Where the events come from, copied into KeyEvent::source
+    void setSource(const std::string &name) { source = name; }
+
+    // Rebuilds the combination and reports the change that caused it
+    void emit(uint32_t type, uint32_t detail, const std::string &label, unsigned long time,
+              const char *device = "");
+
+    // Pull-based alternative to the listener; returns false when nothing is queued
+    bool nextEvent(KeyEvent &event);
+
+    const std::string &combination() const { return currentCombination; }
+    bool empty() const { return activeKeys.empty(); }
+
+private:
+    void updateKeyCombination();
+
+    std::set<std::string> activeKeys;
+    std::string command;
+    std::string source;
+    std::string currentCombination;  // Before uppercasing, "" when nothing is held
+    Listener listener;
+    std::deque<KeyEvent> queue;
+};
+
+// Uppercases the ASCII letters of a label or combination the way it is displayed
+std::string toUppercase(const std::string &text);
+
+#endif
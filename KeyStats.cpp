@@ -0,0 +1,179 @@
+#include "KeyStats.h"
+#include "KeySequence.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <X11/Xlib.h>
+
+KeyStats::KeyStats() : droppedChords(0), totalKeys(0) {
+    for (int i = 0; i < KEYCODES; i++) {
+        keyCounts[i].store(0, std::memory_order_relaxed);
+        keySyms[i].store(0, std::memory_order_relaxed);
+    }
+    for (ChordSlot &slot : chords) {
+        slot.chord.store(0, std::memory_order_relaxed);
+        slot.count.store(0, std::memory_order_relaxed);
+    }
+    for (SecondBucket &bucket : window) {
+        bucket.second.store(-1, std::memory_order_relaxed);
+        bucket.count.store(0, std::memory_order_relaxed);
+    }
+}
+
+int64_t KeyStats::currentSecond() const {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void KeyStats::recordKey(int keycode, unsigned long keysym, uint64_t chord) {
+    keycode &= KEYCODES - 1;
+    keyCounts[keycode].fetch_add(1, std::memory_order_relaxed);
+    if (keySyms[keycode].load(std::memory_order_relaxed) == 0) {
+        keySyms[keycode].store(keysym, std::memory_order_relaxed);
+    }
+    totalKeys.fetch_add(1, std::memory_order_relaxed);
+
+    // Only the capture thread writes, so a bucket can be recycled without a CAS
+    int64_t second = currentSecond();
+    SecondBucket &bucket = window[second % WINDOW_SECONDS];
+    if (bucket.second.load(std::memory_order_relaxed) != second) {
+        bucket.count.store(0, std::memory_order_relaxed);
+        bucket.second.store(second, std::memory_order_release);
+    }
+    bucket.count.fetch_add(1, std::memory_order_relaxed);
+
+    if (chord == 0) {
+        return;
+    }
+
+    // Linear probing; a slot's chord is published after its count is zeroed
+    size_t index = (chord * 0x9E3779B97F4A7C15ULL) >> 52;
+    for (int probe = 0; probe < CHORD_SLOTS; probe++) {
+        ChordSlot &slot = chords[(index + probe) & (CHORD_SLOTS - 1)];
+        uint64_t current = slot.chord.load(std::memory_order_relaxed);
+        if (current == chord) {
+            slot.count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (current == 0) {
+            slot.count.store(1, std::memory_order_relaxed);
+            slot.chord.store(chord, std::memory_order_release);
+            return;
+        }
+    }
+    droppedChords.fetch_add(1, std::memory_order_relaxed);
+}
+
+double KeyStats::keysPerMinute(int seconds) const {
+    if (seconds <= 0 || seconds > WINDOW_SECONDS) {
+        seconds = WINDOW_SECONDS;
+    }
+
+    int64_t now = currentSecond();
+    uint64_t keys = 0;
+    for (int64_t second = now - seconds + 1; second <= now; second++) {
+        const SecondBucket &bucket = window[second % WINDOW_SECONDS];
+        if (bucket.second.load(std::memory_order_acquire) == second) {
+            keys += bucket.count.load(std::memory_order_relaxed);
+        }
+    }
+    return keys * 60.0 / seconds;
+}
+
+static const char *keysymName(unsigned long keysym) {
+    const char *name = keysym ? XKeysymToString(keysym) : nullptr;
+    return name ? name : "NoSymbol";
+}
+
+// Chord and key names are X keysym names, which never need escaping except '\\' and '"'
+static void writeJsonString(std::FILE *file, const std::string &text) {
+    std::fputc('"', file);
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            std::fputc('\\', file);
+        }
+        std::fputc(c, file);
+    }
+    std::fputc('"', file);
+}
+
+bool KeyStats::exportJson(std::FILE *file) const {
+    uint64_t hottest = 1;
+    for (int i = 0; i < KEYCODES; i++) {
+        hottest = std::max<uint64_t>(hottest, keyCounts[i].load(std::memory_order_relaxed));
+    }
+
+    std::fprintf(file, "{\n  \"total_keys\": %llu,\n",
+                 static_cast<unsigned long long>(totalKeys.load(std::memory_order_relaxed)));
+    std::fprintf(file, "  \"keys_per_minute\": {\"1m\": %.1f, \"5m\": %.1f, \"15m\": %.1f},\n",
+                 keysPerMinute(60), keysPerMinute(300), keysPerMinute(900));
+
+    // The heatmap is the per-key count scaled to the most used key
+    std::fprintf(file, "  \"keys\": [");
+    bool first = true;
+    for (int i = 0; i < KEYCODES; i++) {
+        uint64_t count = keyCounts[i].load(std::memory_order_relaxed);
+        if (!count) {
+            continue;
+        }
+        std::fprintf(file, "%s\n    {\"keycode\": %d, \"key\": ", first ? "" : ",", i);
+        writeJsonString(file, keysymName(keySyms[i].load(std::memory_order_relaxed)));
+        std::fprintf(file, ", \"count\": %llu, \"heat\": %.3f}",
+                     static_cast<unsigned long long>(count), double(count) / hottest);
+        first = false;
+    }
+
+    std::fprintf(file, "\n  ],\n  \"chords\": [");
+    first = true;
+    for (const ChordSlot &slot : chords) {
+        uint64_t chord = slot.chord.load(std::memory_order_acquire);
+        if (!chord) {
+            continue;
+        }
+        std::fprintf(file, "%s\n    {\"chord\": ", first ? "" : ",");
+        writeJsonString(file, formatChord(chord));
+        std::fprintf(file, ", \"count\": %llu}",
+                     static_cast<unsigned long long>(slot.count.load(std::memory_order_relaxed)));
+        first = false;
+    }
+    std::fprintf(file, "\n  ],\n  \"dropped_chords\": %llu\n}\n",
+                 static_cast<unsigned long long>(droppedChords.load(std::memory_order_relaxed)));
+    return true;
+}
+
+bool KeyStats::exportCsv(std::FILE *file) const {
+    std::fprintf(file, "kind,name,keycode,count\n");
+    for (int i = 0; i < KEYCODES; i++) {
+        uint64_t count = keyCounts[i].load(std::memory_order_relaxed);
+        if (count) {
+            std::fprintf(file, "key,%s,%d,%llu\n", keysymName(keySyms[i].load(std::memory_order_relaxed)),
+                         i, static_cast<unsigned long long>(count));
+        }
+    }
+    for (const ChordSlot &slot : chords) {
+        uint64_t chord = slot.chord.load(std::memory_order_acquire);
+        if (chord) {
+            std::fprintf(file, "chord,%s,,%llu\n", formatChord(chord).c_str(),
+                         static_cast<unsigned long long>(slot.count.load(std::memory_order_relaxed)));
+        }
+    }
+    std::fprintf(file, "kpm,1m,,%.1f\nkpm,5m,,%.1f\nkpm,15m,,%.1f\n",
+                 keysPerMinute(60), keysPerMinute(300), keysPerMinute(900));
+    return true;
+}
+
+bool KeyStats::exportTo(const std::string &path) const {
+    // Write to a temporary file first so readers never see a half-written snapshot
+    std::string temporary = path + ".tmp";
+    std::FILE *file = std::fopen(temporary.c_str(), "w");
+    if (!file) {
+        std::cerr << "Cannot write statistics to " << temporary << std::endl;
+        return false;
+    }
+
+    bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    bool ok = csv ? exportCsv(file) : exportJson(file);
+    ok = std::fclose(file) == 0 && ok;
+    return ok && std::rename(temporary.c_str(), path.c_str()) == 0;
+}
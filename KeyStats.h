@@ -0,0 +1,52 @@
+#ifndef KEYSTATS_H
+#define KEYSTATS_H
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+
+// Usage counters fed from the capture thread and read from any other thread.
+// Recording never allocates or locks: every counter is a relaxed atomic in a
+// fixed-size table, so a snapshot may be a few keystrokes behind but never blocks capture.
+class KeyStats {
+public:
+    static const int KEYCODES = 256;
+    static const int CHORD_SLOTS = 4096;   // Open-addressed, power of two
+    static const int WINDOW_SECONDS = 900;  // Longest keystrokes-per-minute window
+
+    KeyStats();
+
+    // Called for every keypress; chord is 0 for modifier keys
+    void recordKey(int keycode, unsigned long keysym, uint64_t chord);
+
+    // Keystrokes per minute averaged over the last `seconds` seconds
+    double keysPerMinute(int seconds) const;
+
+    // Writes a snapshot as JSON or CSV, picked from the file extension
+    bool exportTo(const std::string &path) const;
+
+private:
+    struct ChordSlot {
+        std::atomic<uint64_t> chord;  // 0 while the slot is free
+        std::atomic<uint64_t> count;
+    };
+
+    struct SecondBucket {
+        std::atomic<int64_t> second;
+        std::atomic<uint32_t> count;
+    };
+
+    int64_t currentSecond() const;
+    bool exportJson(std::FILE *file) const;
+    bool exportCsv(std::FILE *file) const;
+
+    std::atomic<uint64_t> keyCounts[KEYCODES];
+    std::atomic<unsigned long> keySyms[KEYCODES];  // First keysym seen, used for names
+    ChordSlot chords[CHORD_SLOTS];
+    std::atomic<uint64_t> droppedChords;            // Distinct chords beyond the table size
+    SecondBucket window[WINDOW_SECONDS];
+    std::atomic<uint64_t> totalKeys;
+};
+
+#endif
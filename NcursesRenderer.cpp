@@ -0,0 +1,66 @@
+#include "NcursesRenderer.h"
+#include "KeyState.h"
+#include "TextWidth.h"
+#include "Trace.h"
+
+#include <mutex>
+#include <ncurses.h>  // ncurses for lightweight terminal-based UI; link ncursesw for UTF-8
+#include <cstdlib>    // for system()
+
+#ifdef _WIN32
+    #include <windows.h>
+#endif
+
+std::mutex output_mutex;
+
+void initNcurses() {
+    initscr();  // Initialize the ncurses screen
+    cbreak();   // Disable line buffering
+    noecho();   // Disable echoing of typed characters
+    curs_set(0);  // Hide the cursor
+    timeout(0);  // Non-blocking input
+    start_color();  // Enable colors if the terminal supports it
+    init_pair(1, COLOR_WHITE, COLOR_BLACK);  // Define text color
+
+#ifdef __linux__
+    // Command to make the terminal always on top using wmctrl (Linux only)
+    system("wmctrl -r :ACTIVE: -b add,above");
+#elif _WIN32
+    // Make console window always on top in Windows
+    SetWindowPos(GetConsoleWindow(), HWND_TOPMOST, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE);
+#endif
+}
+
+void setColors(short foreground, short background) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    init_pair(1, foreground, background);
+    refresh();
+}
+
+void renderText(const std::string& inputText) {
+    CSK_TRACE_SCOPE("renderText");
+    std::lock_guard<std::mutex> lock(output_mutex);
+
+    clear();  // Clear the screen
+    attron(COLOR_PAIR(1));  // Set the color
+
+    int term_width, term_height;
+    getmaxyx(stdscr, term_height, term_width);  // Get the terminal size
+
+    // Center by terminal columns, not bytes, and cut what doesn't fit
+    int text_columns = textColumns(inputText);
+    if (text_columns <= term_width) {
+        int start_x = (term_width - text_columns) / 2;
+        mvaddstr(term_height / 2, start_x, inputText.c_str());  // Never a format string
+    } else {
+        std::string shown = truncateText(inputText, term_width, text_columns);
+        mvaddstr(term_height / 2, 0, shown.c_str());
+    }
+
+    CSK_TRACE_SCOPE("refresh");
+    refresh();  // Refresh the screen to show changes
+}
+
+void showPressedKey(const std::string &combination) {
+    renderText(toUppercase(combination));  // Display the keypress or mouse event
+}
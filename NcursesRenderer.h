@@ -0,0 +1,19 @@
+#ifndef NCURSESRENDERER_H
+#define NCURSESRENDERER_H
+
+#include <string>
+
+// Terminal front end: shows the current combination centered in an ncurses screen
+
+void initNcurses();
+
+// Draws `inputText` centered on an otherwise empty screen; safe to call from any thread
+void renderText(const std::string& inputText);
+
+// Changes the text colors (ncurses color numbers, e.g. COLOR_YELLOW); safe to call from any thread
+void setColors(short foreground, short background);
+
+// Uppercases and draws a key combination
+void showPressedKey(const std::string &combination);
+
+#endif
@@ -0,0 +1,1138 @@
+#include "ScreenKey.h"
+#include "AllocTracker.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <fnmatch.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+
+#ifdef CSK_XCB_BACKEND
+    #include <cstdlib>
+    #include <X11/Xlib-xcb.h>
+#endif
+
+static XErrorHandler previousErrorHandler = nullptr;
+static bool errorHandlerInstalled = false;
+
+// The focused window may be destroyed before its properties are read, so
+// BadWindow errors are expected; anything else goes to the previous handler
+static int ignoreBadWindow(Display *display, XErrorEvent *error) {
+    if (error->error_code == BadWindow) {
+        return 0;
+    }
+    return previousErrorHandler ? previousErrorHandler(display, error) : 0;
+}
+
+ScreenKey::ScreenKey() {
+    std::memset(keymap, 0, sizeof(keymap));
+    initializeKeyMappings();
+}
+
+ScreenKey::~ScreenKey() {
+    close();
+}
+
+void ScreenKey::initializeKeyMappings() {
+    specialKeyMap[XK_apostrophe] = "APOSTROPHE (')";
+    specialKeyMap[XK_slash] = "SLASH (/)";
+    specialKeyMap[XK_backslash] = "BACKSLASH (\\)";
+    specialKeyMap[XK_Left] = "ARROW LEFT";
+    specialKeyMap[XK_Right] = "ARROW RIGHT";
+    specialKeyMap[XK_Up] = "ARROW UP";
+    specialKeyMap[XK_Down] = "ARROW DOWN";
+    specialKeyMap[XK_KP_Divide] = "KP_DIVIDE (/)";
+    specialKeyMap[XK_KP_Multiply] = "KP_MULTIPLY (*)";
+    specialKeyMap[XK_KP_Subtract ] = "KP_SUBTRACT (-)";
+    specialKeyMap[XK_KP_Add] = "KP_ADD (+)";
+    specialKeyMap[XK_bracketleft] = "BRACKETLEFT ([)";
+    specialKeyMap[XK_bracketright] = "BRACKETRIGHT (])";
+    specialKeyMap[XK_comma] = "COMMA (,)";
+    specialKeyMap[XK_period] = "PERIOD (.)";
+    specialKeyMap[XK_dead_acute] = "DEAD_ACUTE (´)";
+    specialKeyMap[XK_dead_tilde] = "DEAD_TILDE (~)";
+    specialKeyMap[XK_dead_cedilla] = "DEAD_CEDILLA (Ç)";
+    specialKeyMap[XK_minus] = "EQUAL (-)";
+    specialKeyMap[XK_equal] = "EQUAL (=)";
+    specialKeyMap[XK_semicolon] = "SEMICOLON (;)";
+    specialKeyMap[XK_Page_Up] = "PAGE UP";
+    specialKeyMap[XK_Page_Down] = "PAGE DOWN";
+    specialKeyMap[XK_Home] = "HOME";
+    specialKeyMap[XK_End] = "END";
+    specialKeyMap[1] = "MOUSE LEFT CLICK";
+    specialKeyMap[2] = "MOUSE MIDDLE CLICK";  // Fixed middle-click support
+    specialKeyMap[3] = "MOUSE RIGHT CLICK";
+    specialKeyMap[4] = "MOUSE SCROLL UP";
+    specialKeyMap[5] = "MOUSE SCROLL DOWN";
+    specialKeyMap[6] = "MOUSE SCROLL LEFT";
+    specialKeyMap[7] = "MOUSE SCROLL RIGHT";
+    specialKeyMap[8] = "MOUSE BACK";
+    specialKeyMap[9] = "MOUSE FORWARD";
+}
+
+bool ScreenKey::open(const char *displayName) {
+    display = XOpenDisplay(displayName);
+    if (!display) {
+        std::cerr << "Cannot open X display " << XDisplayName(displayName) << std::endl;
+        return false;
+    }
+#ifdef CSK_XCB_BACKEND
+    // Events are read straight from XCB; Xlib is only used for requests
+    XSetEventQueueOwner(display, XCBOwnsEventQueue);
+    connection = XGetXCBConnection(display);
+#endif
+    state.setSource(DisplayString(display));
+    for (auto &device : deviceStates) {
+        device.second.state.setSource(DisplayString(display));
+    }
+
+    int event, error;
+    if (!XQueryExtension(display, "XInputExtension", &opcode, &event, &error)) {
+        std::cerr << "X Input extension not available" << std::endl;
+        close();
+        return false;
+    }
+
+    // 2.2 brings smooth-scrolling classes (2.1) and touch events
+    int major = 2, minor = 2;
+    if (XIQueryVersion(display, &major, &minor) != Success) {
+        std::cerr << "XInput2 not available" << std::endl;
+        close();
+        return false;
+    }
+    touchSupported = major > 2 || minor >= 2;
+
+    Window root = DefaultRootWindow(display);
+
+    // Master devices only: slave devices would deliver every input a second time.
+    // The physical device is still known from the event's sourceid.
+    XIEventMask evmask;
+    unsigned char mask[(XI_LASTEVENT + 7) / 8] = {0};
+    evmask.deviceid = XIAllMasterDevices;
+    evmask.mask_len = sizeof(mask);
+    evmask.mask = mask;
+
+    XISetMask(mask, XI_KeyPress);
+    XISetMask(mask, XI_KeyRelease);
+    XISetMask(mask, XI_ButtonPress);
+    XISetMask(mask, XI_ButtonRelease);
+    XISetMask(mask, XI_Motion);  // Drags and smooth-scrolling valuators
+
+    // Raw touch events reach the root even when the touched window selects touch itself
+    if (touchSupported) {
+        XISetMask(mask, XI_RawTouchBegin);
+        XISetMask(mask, XI_RawTouchUpdate);
+        XISetMask(mask, XI_RawTouchEnd);
+    }
+
+    // Device hierarchy changes can only be selected for all devices
+    XIEventMask hierarchyMask;
+    unsigned char hierarchyBits[(XI_LASTEVENT + 7) / 8] = {0};
+    hierarchyMask.deviceid = XIAllDevices;
+    hierarchyMask.mask_len = sizeof(hierarchyBits);
+    hierarchyMask.mask = hierarchyBits;
+    XISetMask(hierarchyBits, XI_HierarchyChanged);
+
+    XIEventMask masks[2] = {evmask, hierarchyMask};
+    XISelectEvents(display, root, masks, 2);
+
+    // Follow the focused window for the privacy rules
+    if (!errorHandlerInstalled) {
+        previousErrorHandler = XSetErrorHandler(ignoreBadWindow);
+        errorHandlerInstalled = true;
+    }
+    netActiveWindow = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
+    netWmName = XInternAtom(display, "_NET_WM_NAME", False);
+    utf8String = XInternAtom(display, "UTF8_STRING", False);
+    XSelectInput(display, root, PropertyChangeMask);
+    activeWindow = None;
+    updateFocus();
+
+    // Keep the label table in step with layout and keymap changes
+    int xkbOpcode, xkbError, xkbMajor = XkbMajorVersion, xkbMinor = XkbMinorVersion;
+    if (XkbQueryExtension(display, &xkbOpcode, &xkbEventBase, &xkbError, &xkbMajor, &xkbMinor)) {
+        unsigned int notify = XkbMapNotifyMask | XkbNewKeyboardNotifyMask;
+        XkbSelectEvents(display, XkbUseCoreKbd, notify, notify);
+    } else {
+        xkbEventBase = -1;
+    }
+    loadKeyLabels();
+
+    loadDevices();
+    clear();
+    resync();
+    return true;
+}
+
+void ScreenKey::close() {
+#ifdef CSK_XCB_BACKEND
+    std::free(peeked);
+    peeked = nullptr;
+    connection = nullptr;
+#endif
+    if (display) {
+        XCloseDisplay(display);
+        display = nullptr;
+    }
+}
+
+void ScreenKey::clear() {
+    state.clear();
+    for (auto &device : deviceStates) {
+        device.second.state.clear();
+        std::memset(device.second.keymap, 0, sizeof(device.second.keymap));
+        for (std::string &label : device.second.heldLabels) {
+            label.clear();
+        }
+    }
+    std::memset(keymap, 0, sizeof(keymap));
+    for (std::string &label : heldLabels) {
+        label.clear();
+    }
+    composeNode = ComposeTable::ROOT;
+    dragButton = 0;
+    dragging = false;
+    touchGesture = nullptr;
+}
+
+void ScreenKey::setListener(KeyState::Listener callback) {
+    listener = std::move(callback);
+    state.setListener(listener);
+    for (auto &device : deviceStates) {
+        device.second.state.setListener(listener);
+    }
+}
+
+bool ScreenKey::nextEvent(KeyEvent &event) {
+    if (state.nextEvent(event)) {
+        return true;
+    }
+    for (auto &device : deviceStates) {
+        if (device.second.state.nextEvent(event)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads every slave keyboard and pointer once, so events only index a vector
+void ScreenKey::loadDevices() {
+    devices.clear();
+    int count = 0;
+    XIDeviceInfo *info = XIQueryDevice(display, XIAllDevices, &count);
+    for (int i = 0; i < count; i++) {
+        if (info[i].use != XISlaveKeyboard && info[i].use != XISlavePointer &&
+            info[i].use != XIFloatingSlave) {
+            continue;
+        }
+        if (info[i].deviceid >= static_cast<int>(devices.size())) {
+            devices.resize(info[i].deviceid + 1);
+        }
+        DeviceInfo &device = devices[info[i].deviceid];
+        device.name = info[i].name;
+
+        int axes = 0;
+        for (int c = 0; c < info[i].num_classes && axes < 2; c++) {
+            if (info[i].classes[c]->type == XIScrollClass) {
+                XIScrollClassInfo *scroll = reinterpret_cast<XIScrollClassInfo *>(info[i].classes[c]);
+                device.scroll[axes].number = scroll->number;
+                device.scroll[axes].horizontal = scroll->scroll_type == XIScrollTypeHorizontal;
+                device.scroll[axes].increment = scroll->increment ? scroll->increment : 1;
+                axes++;
+            }
+        }
+        // Start from the current values so the first event yields a delta
+        for (int c = 0; c < info[i].num_classes; c++) {
+            if (info[i].classes[c]->type != XIValuatorClass) {
+                continue;
+            }
+            XIValuatorClassInfo *valuator = reinterpret_cast<XIValuatorClassInfo *>(info[i].classes[c]);
+            for (ScrollAxis &axis : device.scroll) {
+                if (axis.number == valuator->number) {
+                    axis.last = valuator->value;
+                }
+            }
+            if (valuator->number < 2 && valuator->max > valuator->min) {
+                device.range[valuator->number] = valuator->max - valuator->min;
+            }
+        }
+    }
+    XIFreeDeviceInfo(info);
+}
+
+const char *ScreenKey::deviceName(int deviceId) const {
+    if (deviceId < 0 || deviceId >= static_cast<int>(devices.size())) {
+        return "";
+    }
+    return devices[deviceId].name.c_str();
+}
+
+KeyState &ScreenKey::stateFor(int deviceId) {
+    if (!perDevice) {
+        lastState = &state;
+        return state;
+    }
+
+    auto found = deviceStates.find(deviceId);
+    if (found == deviceStates.end()) {
+        found = deviceStates.emplace(deviceId, DeviceKeys()).first;
+        found->second.state.setListener(listener);
+        found->second.state.setSource(display ? DisplayString(display) : "");
+    }
+    lastState = &found->second.state;
+    return found->second.state;
+}
+
+// Where the label a key was pressed with is kept until its release
+std::string &ScreenKey::heldLabel(int deviceId, int keycode) {
+    if (!perDevice) {
+        return heldLabels[keycode & 255];
+    }
+    stateFor(deviceId);  // Creates the device's entry
+    return deviceStates[deviceId].heldLabels[keycode & 255];
+}
+
+std::string ScreenKey::keyLabel(KeySym keysym) {
+    // Check for special key mapping
+    auto special = specialKeyMap.find(keysym);
+    if (special != specialKeyMap.end()) {
+        return special->second;
+    }
+    const char *name = XKeysymToString(keysym);
+    return name ? name : "";
+}
+
+void ScreenKey::loadKeyLabels() {
+    XkbDescPtr xkb = XkbGetMap(display, XkbKeyTypesMask | XkbKeySymsMask, XkbUseCoreKbd);
+    if (!xkb) {
+        std::cerr << "Cannot read the XKB keyboard map" << std::endl;
+        return;
+    }
+
+    // Level of every key type for each combination of real modifiers
+    int types = xkb->map->num_types;  // An unsigned char, like the keyTypes entries that index it
+    typeLevels.assign((types ? types : 1) * 256, 0);
+    for (int t = 0; t < types; t++) {
+        const XkbKeyTypeRec &type = xkb->map->types[t];
+        for (int mods = 0; mods < 256; mods++) {
+            for (int e = 0; e < type.map_count; e++) {
+                const XkbKTMapEntryRec &entry = type.map[e];
+                if (entry.active && (mods & type.mods.mask) == entry.mods.mask) {
+                    typeLevels[t * 256 + mods] = entry.level < MAX_LEVELS ? entry.level : 0;
+                    break;
+                }
+            }
+        }
+    }
+
+    keyLabels.assign(256 * MAX_GROUPS * MAX_LEVELS, KeyLabel());
+    keyTypes.assign(256 * MAX_GROUPS, 0);
+    for (int keycode = xkb->min_key_code; keycode <= xkb->max_key_code; keycode++) {
+        int groups = XkbKeyNumGroups(xkb, keycode);
+        for (int g = 0; g < MAX_GROUPS && groups > 0; g++) {
+            int group = g % groups;  // Out-of-range groups wrap, XKB's default
+            int type = XkbKeyKeyTypeIndex(xkb, keycode, group);
+            keyTypes[keycode * MAX_GROUPS + g] = type < types ? type : 0;
+
+            int width = XkbKeyGroupWidth(xkb, keycode, group);
+            for (int level = 0; level < width && level < MAX_LEVELS; level++) {
+                KeyLabel &entry = keyLabels[(keycode * MAX_GROUPS + g) * MAX_LEVELS + level];
+                entry.keysym = XkbKeySymEntry(xkb, keycode, level, group);
+                if (entry.keysym != NoSymbol) {
+                    entry.label = keyLabel(entry.keysym);
+                }
+            }
+        }
+    }
+    XkbFreeKeyboard(xkb, 0, True);
+}
+
+void ScreenKey::loadKeysyms(const std::vector<std::pair<int, KeySym>> &keysyms) {
+    typeLevels.assign(256, 0);  // One key type, always level 0
+    keyTypes.assign(256 * MAX_GROUPS, 0);
+    keyLabels.assign(256 * MAX_GROUPS * MAX_LEVELS, KeyLabel());
+    for (const auto &entry : keysyms) {
+        if (entry.first < 0 || entry.first > 255) {
+            continue;
+        }
+        for (int g = 0; g < MAX_GROUPS; g++) {
+            KeyLabel &label = keyLabels[(entry.first * MAX_GROUPS + g) * MAX_LEVELS];
+            label.keysym = entry.second;
+            label.label = keyLabel(entry.second);
+        }
+    }
+}
+
+void ScreenKey::loadScrollAxis(int deviceId, int valuator, bool horizontal, double increment) {
+    if (deviceId < 0) {
+        return;
+    }
+    if (deviceId >= static_cast<int>(devices.size())) {
+        devices.resize(deviceId + 1);
+    }
+    ScrollAxis *axis = &devices[deviceId].scroll[0];
+    if (axis->number >= 0 && axis->number != valuator) {
+        axis = &devices[deviceId].scroll[1];
+    }
+    axis->number = valuator;
+    axis->horizontal = horizontal;
+    axis->increment = increment ? increment : 1;
+    axis->last = 0;
+}
+
+const ScreenKey::KeyLabel &ScreenKey::lookupKey(int keycode, int group, int mods) const {
+    CSK_TRACE_SCOPE("keyLabel");
+    static const KeyLabel none;
+    if (keyLabels.empty() || keycode < 0 || keycode > 255) {
+        return none;
+    }
+
+    int g = group & (MAX_GROUPS - 1);
+    int level = typeLevels[keyTypes[keycode * MAX_GROUPS + g] * 256 + (mods & 0xff)];
+    const KeyLabel *entries = &keyLabels[(keycode * MAX_GROUPS + g) * MAX_LEVELS];
+    return entries[level].keysym != NoSymbol ? entries[level] : entries[0];
+}
+
+// Group 1, level 1 keysym: what chords, sequences and statistics are keyed on
+KeySym ScreenKey::baseKeysym(int keycode) const {
+    if (keyLabels.empty() || keycode < 0 || keycode > 255) {
+        return NoSymbol;
+    }
+    return keyLabels[keycode * MAX_GROUPS * MAX_LEVELS].keysym;
+}
+
+void ScreenKey::setLabels(const std::vector<std::pair<unsigned long, std::string>> &labels) {
+    specialKeyMap.clear();
+    initializeKeyMappings();
+    for (const auto &label : labels) {
+        specialKeyMap[label.first] = label.second;
+    }
+    if (display) {
+        loadKeyLabels();  // Held keys keep their old label in heldLabels until released
+    }
+}
+
+void ScreenKey::setPrivacyRules(const std::vector<std::string> &rules) {
+    privacyRules = rules;
+    privacyActive = matchesPrivacyRules();
+}
+
+bool ScreenKey::matchesPrivacyRules() const {
+    for (const std::string &rule : privacyRules) {
+        const char *glob = rule.c_str();
+        bool byClass = true, byTitle = true;
+        if (rule.compare(0, 6, "class:") == 0) {
+            glob += 6;
+            byTitle = false;
+        } else if (rule.compare(0, 6, "title:") == 0) {
+            glob += 6;
+            byClass = false;
+        }
+        if (byClass && (fnmatch(glob, activeClass[0].c_str(), FNM_CASEFOLD) == 0 ||
+                        fnmatch(glob, activeClass[1].c_str(), FNM_CASEFOLD) == 0)) {
+            return true;
+        }
+        if (byTitle && fnmatch(glob, activeTitle.c_str(), FNM_CASEFOLD) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string ScreenKey::windowTitle(Window window) const {
+    std::string title;
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char *data = nullptr;
+    if (XGetWindowProperty(display, window, netWmName, 0, 1024, False, utf8String,
+                           &type, &format, &count, &after, &data) == Success && data) {
+        title.assign(reinterpret_cast<char *>(data), count);
+        XFree(data);
+    }
+    if (title.empty()) {
+        char *name = nullptr;
+        if (XFetchName(display, window, &name) && name) {
+            title = name;
+            XFree(name);
+        }
+    }
+    return title;
+}
+
+// Reads the focused window and its class and title; runs only when they change
+void ScreenKey::updateFocus() {
+    CSK_TRACE_SCOPE("updateFocus");
+    Window root = DefaultRootWindow(display);
+    Window window = None;
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char *data = nullptr;
+    if (XGetWindowProperty(display, root, netActiveWindow, 0, 1, False, XA_WINDOW,
+                           &type, &format, &count, &after, &data) == Success && data) {
+        if (count == 1 && format == 32) {
+            window = *reinterpret_cast<Window *>(data);  // Format 32 properties are longs
+        }
+        XFree(data);
+    }
+
+    if (window != activeWindow) {
+        if (activeWindow != None && activeWindow != root) {
+            XSelectInput(display, activeWindow, NoEventMask);  // May be gone already
+        }
+        activeWindow = window;
+        activeClass[0].clear();
+        activeClass[1].clear();
+        if (window != None && window != root) {
+            // Select before reading, so a title change in between is not missed
+            XSelectInput(display, window, PropertyChangeMask);
+            XClassHint hint;
+            if (XGetClassHint(display, window, &hint)) {
+                activeClass[0] = hint.res_name ? hint.res_name : "";
+                activeClass[1] = hint.res_class ? hint.res_class : "";
+                XFree(hint.res_name);
+                XFree(hint.res_class);
+            }
+        }
+        const ShortcutProfiles::Profile *profile = shortcutProfiles.find(activeClass[0], activeClass[1]);
+        if (profile != activeProfile) {
+            // The last window's action names don't describe keys pressed in this one
+            state.setCommand("");
+            for (auto &device : deviceStates) {
+                device.second.state.setCommand("");
+            }
+            activeProfile = profile;
+        }
+    }
+    activeTitle = window != None ? windowTitle(window) : "";
+    privacyActive = matchesPrivacyRules();
+}
+
+void ScreenKey::handlePropertyEvent(Window window, Atom atom) {
+    if (window == DefaultRootWindow(display) && atom == netActiveWindow) {
+        // XI focus and crossing events on the root rarely arrive, so a focus switch is seen here
+        updateFocus();
+        focusChanged = true;
+    } else if (window == activeWindow && (atom == netWmName || atom == XA_WM_NAME)) {
+        activeTitle = windowTitle(window);  // e.g. a terminal now running sudo
+        privacyActive = matchesPrivacyRules();
+    }
+}
+
+std::string ScreenKey::buttonLabel(int button) {
+    auto special = specialKeyMap.find(button);
+    return special != specialKeyMap.end() ? special->second : "Unknown Mouse Button";
+}
+
+// The chord formed by a non-modifier keypress, 0 for modifier keys
+uint64_t ScreenKey::chord(XIDeviceEvent *xide, KeySym keysym) const {
+    if (IsModifierKey(keysym)) {
+        return 0;
+    }
+
+    unsigned int mods = 0;
+    if (xide->mods.effective & ControlMask) mods |= CHORD_CTRL;
+    if (xide->mods.effective & ShiftMask) mods |= CHORD_SHIFT;
+    if (xide->mods.effective & Mod1Mask) mods |= CHORD_ALT;
+    if (xide->mods.effective & Mod4Mask) mods |= CHORD_SUPER;
+    return makeChord(mods, keysym);
+}
+
+void ScreenKey::setKeycodePressed(int deviceId, int keycode, bool pressed) {
+    keycode &= 255;
+    unsigned char bit = 1 << (keycode & 7);
+    if (perDevice) {
+        stateFor(deviceId);
+        unsigned char &byte = deviceStates[deviceId].keymap[keycode >> 3];
+        byte = pressed ? byte | bit : byte & ~bit;
+        if (!pressed) {
+            for (const auto &device : deviceStates) {
+                if (device.second.keymap[keycode >> 3] & bit) {
+                    return;  // Still held on another device
+                }
+            }
+        }
+    }
+    keymap[keycode >> 3] = pressed ? keymap[keycode >> 3] | bit : keymap[keycode >> 3] & ~bit;
+}
+
+void ScreenKey::handleKeyPress(XIDeviceEvent *xide) {
+    CSK_ALLOC_SCOPE("handleKeyPress");
+    CSK_TRACE_SCOPE("handleKeyPress");
+    if (privacyActive) {
+        // Only tracked, so the release and resyncs stay consistent; a sequence
+        // or compose in progress is dropped rather than finished by hidden keys
+        setKeycodePressed(xide->sourceid, xide->detail, true);
+        sequenceMatcher.reset();
+        composeNode = ComposeTable::ROOT;
+        return;
+    }
+    const KeyLabel &key = lookupKey(xide->detail, xide->group.effective, xide->mods.effective);
+    const std::string *label = &key.label;
+    KeySym keysym = baseKeysym(xide->detail);
+
+    // Modifiers don't break a compose sequence, "dead_acute Shift+e" is "É"
+    if (compose && key.keysym != NoSymbol && !IsModifierKey(key.keysym)) {
+        composeNode = compose->step(composeNode, key.keysym);
+        const char *composed = compose->result(composeNode);
+        if (composed) {
+            composedLabel.assign(composed);
+            label = &composedLabel;
+            composeNode = ComposeTable::ROOT;
+        }
+    }
+    const std::string &keyStr = *label;
+
+    uint64_t keyChord = chord(xide, keysym);
+    KeyState &keys = stateFor(xide->sourceid);
+    if (keys.empty()) {
+        keys.setCommand("");  // A new chord; the last one's command or action no longer applies
+    }
+    if (keyChord != 0 && (sequenceMatcher.size() > 0 || shortcutProfiles.size() > 0)) {
+        // A completed sequence wins over what the chord means in this application
+        const std::string *command = nullptr;
+        if (sequenceMatcher.size() > 0) {
+            command = sequenceMatcher.advance(keyChord, xide->time);
+        }
+        if (!command && activeProfile) {
+            command = activeProfile->action(keyChord);
+        }
+        keys.setCommand(command ? *command : "");
+    }
+    setKeycodePressed(xide->sourceid, xide->detail, true);
+
+    if (stats) {
+        stats->recordKey(xide->detail, keysym, keyChord);
+    }
+
+    if (!keyStr.empty()) {
+        // A label already held for this key (a resync that raced this press, or
+        // a press whose release was lost) would otherwise never be removed
+        std::string &held = heldLabel(xide->sourceid, xide->detail);
+        if (!held.empty() && held != keyStr) {
+            keys.remove(held);
+        }
+        held = keyStr;
+        keys.add(keyStr);
+        keys.emit(KEY_EVENT_PRESS, xide->detail, keyStr, xide->time, deviceName(xide->sourceid));
+    }
+}
+
+void ScreenKey::handleKeyRelease(XIDeviceEvent *xide) {
+    CSK_ALLOC_SCOPE("handleKeyRelease");
+    CSK_TRACE_SCOPE("handleKeyRelease");
+    int keycode = xide->detail & 255;
+    std::string &keyStr = heldLabel(xide->sourceid, keycode);
+
+    setKeycodePressed(xide->sourceid, keycode, false);
+
+    if (!keyStr.empty()) {
+        KeyState &keys = stateFor(xide->sourceid);
+        keys.remove(keyStr);
+        keys.emit(KEY_EVENT_RELEASE, xide->detail, keyStr, xide->time, deviceName(xide->sourceid));
+        keyStr.clear();
+    }
+
+    // A resync can't tell which device holds a key, so keys it found down sit
+    // in the shared set until no device holds them any more
+    std::string &foundDown = heldLabels[keycode];
+    if (perDevice && !foundDown.empty() && !(keymap[keycode >> 3] & (1 << (keycode & 7)))) {
+        lastState = &state;
+        state.remove(foundDown);
+        state.emit(KEY_EVENT_RELEASE, xide->detail, foundDown, xide->time, deviceName(xide->sourceid));
+        foundDown.clear();
+    }
+}
+
+static const char *dragLabel(int button) {
+    static const char *labels[] = {"", "MOUSE LEFT DRAG", "MOUSE MIDDLE DRAG", "MOUSE RIGHT DRAG"};
+    return labels[button];
+}
+
+void ScreenKey::handleButtonPress(XIDeviceEvent *xide) {
+    CSK_ALLOC_SCOPE("handleButton");
+    CSK_TRACE_SCOPE("handleButton");
+    if (xide->flags & XIPointerEmulated) {
+        return;  // Emulated from scroll valuators or touches, which are read directly
+    }
+    if (xide->detail >= 4 && xide->detail <= 7) {
+        addScroll(xide->sourceid, xide->detail - 4, 1, xide->time);  // Wheel notches are counted, not held
+        return;
+    }
+
+    std::string buttonStr = buttonLabel(xide->detail);
+    if (buttonStr.empty()) {
+        return;  // Hidden
+    }
+
+    if (dragThreshold > 0 && dragButton == 0 && xide->detail >= 1 && xide->detail <= 3) {
+        dragButton = xide->detail;
+        dragDevice = xide->sourceid;
+        dragging = false;
+        pressX = pointerX = xide->root_x;
+        pressY = pointerY = xide->root_y;
+    }
+
+    KeyState &keys = stateFor(xide->sourceid);
+    if (keys.empty()) {
+        keys.setCommand("");
+    }
+    keys.add(buttonStr);
+    keys.emit(KEY_EVENT_BUTTON_PRESS, xide->detail, buttonStr, xide->time, deviceName(xide->sourceid));
+}
+
+void ScreenKey::handleButtonRelease(XIDeviceEvent *xide) {
+    CSK_ALLOC_SCOPE("handleButton");
+    CSK_TRACE_SCOPE("handleButton");
+    if ((xide->flags & XIPointerEmulated) || (xide->detail >= 4 && xide->detail <= 7)) {
+        return;
+    }
+    std::string buttonStr = buttonLabel(xide->detail);
+    if (buttonStr.empty()) {
+        return;
+    }
+    KeyState &keys = stateFor(xide->sourceid);
+    if (xide->detail == dragButton) {
+        if (dragging) {
+            keys.remove(dragLabel(dragButton));
+        }
+        dragButton = 0;
+        dragging = false;
+    }
+    keys.remove(buttonStr);
+    keys.emit(KEY_EVENT_BUTTON_RELEASE, xide->detail, buttonStr, xide->time, deviceName(xide->sourceid));
+}
+
+void ScreenKey::handleMotion(XIDeviceEvent *xide) {
+    pointerX = xide->root_x;
+    pointerY = xide->root_y;
+    motionTime = xide->time;
+    motionPending = true;
+    handleScrollValuators(xide);
+}
+
+void ScreenKey::handleScrollValuators(XIDeviceEvent *xide) {
+    if (xide->sourceid < 0 || xide->sourceid >= static_cast<int>(devices.size())) {
+        return;
+    }
+    DeviceInfo &device = devices[xide->sourceid];
+    if (device.scroll[0].number < 0) {
+        return;
+    }
+
+    // Values are packed: one per bit set in the mask
+    const double *value = xide->valuators.values;
+    for (int i = 0; i < xide->valuators.mask_len * 8; i++) {
+        if (!XIMaskIsSet(xide->valuators.mask, i)) {
+            continue;
+        }
+        for (ScrollAxis &axis : device.scroll) {
+            if (axis.number != i) {
+                continue;
+            }
+            double notches = (*value - axis.last) / axis.increment;
+            axis.last = *value;
+            // A legacy wheel sends real buttons 4-7, already counted, plus emulated valuator motion
+            if (notches != 0 && !(xide->flags & XIPointerEmulated)) {
+                int direction = (axis.horizontal ? 2 : 0) + (notches > 0 ? 1 : 0);
+                addScroll(xide->sourceid, direction, notches > 0 ? notches : -notches, xide->time);
+            }
+        }
+        value++;
+    }
+}
+
+void ScreenKey::addScroll(int deviceId, int direction, double notches, Time time) {
+    if (direction != scrollDirection || time - scrollTime > SCROLL_STREAK_MS) {
+        scrollDirection = direction;
+        scrollNotches = 0;
+        scrollShown = 0;
+    }
+    scrollDevice = deviceId;
+    scrollNotches += notches;
+    scrollTime = time;
+    scrollPending = true;
+}
+
+// Reports the scroll streak once per batch, and only when it grew by a whole notch
+void ScreenKey::updateScroll() {
+    scrollPending = false;
+    int notches = static_cast<int>(scrollNotches + 0.001);  // Smooth deltas rarely add up exactly
+    if (notches <= scrollShown) {
+        return;
+    }
+    scrollShown = notches;
+
+    int button = 4 + scrollDirection;
+    std::string label = buttonLabel(button);
+    if (label.empty()) {
+        return;
+    }
+    if (notches > 1) {
+        label += " \u00d7" + std::to_string(notches);
+    }
+
+    // Shown together with the held keys (e.g. CONTROL_L + MOUSE SCROLL UP), but never held itself
+    KeyState &keys = stateFor(scrollDevice);
+    keys.add(label);
+    keys.emit(KEY_EVENT_SCROLL, button, label, scrollTime, deviceName(scrollDevice));
+    keys.remove(label);
+}
+
+// Turns the held button into a drag once it moved far enough; runs once per batch
+void ScreenKey::updateDrag() {
+    motionPending = false;
+    if (dragButton == 0 || dragging) {
+        return;
+    }
+
+    double dx = pointerX - pressX, dy = pointerY - pressY;
+    if (dx * dx + dy * dy < double(dragThreshold) * dragThreshold) {
+        return;
+    }
+
+    dragging = true;
+    KeyState &keys = stateFor(dragDevice);
+    keys.remove(buttonLabel(dragButton));
+    keys.add(dragLabel(dragButton));
+    keys.emit(KEY_EVENT_DRAG, dragButton, dragLabel(dragButton), motionTime, deviceName(dragDevice));
+}
+
+void ScreenKey::handleTouch(int type, XIRawEvent *raw) {
+    if (type == XI_RawTouchBegin && touchCount == 0) {
+        // First finger down starts a new gesture
+        std::memset(touches, 0, sizeof(touches));
+        touchMaxCount = 0;
+        touchStart = raw->time;
+        touchDevice = raw->sourceid;
+    }
+
+    TouchPoint *touch = nullptr;
+    for (TouchPoint &candidate : touches) {
+        if (type == XI_RawTouchBegin ? !candidate.active : (candidate.active && candidate.id == raw->detail)) {
+            touch = &candidate;
+            break;
+        }
+    }
+    if (!touch) {
+        return;  // More fingers down than slots, or a touch that began before we started
+    }
+
+    // Values are packed: one per bit set in the mask; only x (0) and y (1) matter
+    const double *value = raw->valuators.values;
+    for (int i = 0; i < 2 && i < raw->valuators.mask_len * 8; i++) {
+        if (XIMaskIsSet(raw->valuators.mask, i)) {
+            (i == 0 ? touch->x : touch->y) = *value++;
+        }
+    }
+
+    if (type == XI_RawTouchBegin) {
+        touch->id = raw->detail;
+        touch->active = true;
+        touch->startX = touch->x;
+        touch->startY = touch->y;
+        touchCount++;
+        touchMaxCount = touchCount > touchMaxCount ? touchCount : touchMaxCount;
+    } else if (type == XI_RawTouchEnd) {
+        touch->active = false;
+        touchCount--;
+        touchEnded = touchCount == 0;
+    }
+    touchTime = raw->time;
+    touchPending = true;
+}
+
+// Names what the fingers down right now are doing, nullptr when nothing is clear yet
+const char *ScreenKey::classifyTouch() const {
+    const double MOVE = 0.03, PINCH = 0.05;  // Fractions of the device's extent
+
+    double rangeX = 1, rangeY = 1;
+    if (touchDevice >= 0 && touchDevice < static_cast<int>(devices.size())) {
+        rangeX = devices[touchDevice].range[0];
+        rangeY = devices[touchDevice].range[1];
+    }
+
+    const TouchPoint *active[2] = {nullptr, nullptr};
+    int count = 0;
+    for (const TouchPoint &touch : touches) {
+        if (touch.active && count < 2) {
+            active[count++] = &touch;
+        }
+    }
+
+    if (touchCount == 1 && (touchMaxCount > 1 || !active[0])) {
+        return touchGesture;  // A finger of a two-finger gesture lifted; the gesture stays until the last one
+    }
+    if (touchCount == 1) {
+        double dx = (active[0]->x - active[0]->startX) / rangeX;
+        double dy = (active[0]->y - active[0]->startY) / rangeY;
+        return dx * dx + dy * dy > MOVE * MOVE ? "TOUCH DRAG" : nullptr;
+    }
+    if (touchCount != 2) {
+        return touchGesture;
+    }
+
+    const TouchPoint &a = *active[0], &b = *active[1];
+    double startDistance = std::hypot((a.startX - b.startX) / rangeX, (a.startY - b.startY) / rangeY);
+    double distance = std::hypot((a.x - b.x) / rangeX, (a.y - b.y) / rangeY);
+    double pinch = distance - startDistance;
+    double dx = (a.x + b.x - a.startX - b.startX) / 2 / rangeX;
+    double dy = (a.y + b.y - a.startY - b.startY) / 2 / rangeY;
+    double shift = std::hypot(dx, dy);
+
+    if (std::fabs(pinch) > PINCH && std::fabs(pinch) > shift) {
+        return pinch > 0 ? "PINCH OUT" : "PINCH IN";
+    }
+    if (shift > MOVE) {
+        if (std::fabs(dy) >= std::fabs(dx)) {
+            return dy > 0 ? "TWO-FINGER SCROLL DOWN" : "TWO-FINGER SCROLL UP";
+        }
+        return dx > 0 ? "TWO-FINGER SCROLL RIGHT" : "TWO-FINGER SCROLL LEFT";
+    }
+    return touchGesture;
+}
+
+// Reports a gesture when it is recognised or changes, and ends it with the last finger
+void ScreenKey::updateTouch() {
+    touchPending = false;
+    KeyState &keys = stateFor(touchDevice);
+
+    const char *gesture = touchCount > 0 ? classifyTouch() : touchGesture;
+    if (gesture != touchGesture) {
+        if (touchGesture) {
+            keys.remove(touchGesture);
+        }
+        if (gesture) {
+            keys.add(gesture);
+            keys.emit(KEY_EVENT_TOUCH, touchMaxCount, gesture, touchTime, deviceName(touchDevice));
+        } else {
+            // A drag moved back to where it started
+            keys.emit(KEY_EVENT_TOUCH_END, touchMaxCount, touchGesture, touchTime, deviceName(touchDevice));
+        }
+        touchGesture = gesture;
+    }
+
+    if (!touchEnded) {
+        return;
+    }
+    touchEnded = false;
+
+    if (touchGesture) {
+        keys.remove(touchGesture);
+        keys.emit(KEY_EVENT_TOUCH_END, touchMaxCount, touchGesture, touchTime, deviceName(touchDevice));
+        touchGesture = nullptr;
+    } else if (touchTime - touchStart < 300) {
+        // Short and never moved far enough to be anything else
+        static const char *taps[] = {"TAP", "TAP", "TWO-FINGER TAP", "THREE-FINGER TAP"};
+        const char *tap = taps[touchMaxCount < 3 ? touchMaxCount : 3];
+        keys.add(tap);
+        keys.emit(KEY_EVENT_TOUCH, touchMaxCount, tap, touchTime, deviceName(touchDevice));
+        keys.remove(tap);
+    }
+}
+
+// Work deferred to the end of a batch of events, so motion, scrolling and
+// touches cause at most one update each
+void ScreenKey::finishBatch() {
+    if (motionPending) {
+        updateDrag();
+    }
+    if (scrollPending) {
+        updateScroll();
+    }
+    if (touchPending) {
+        updateTouch();
+    }
+}
+
+void ScreenKey::injectEvent(int evtype, void *data) {
+    CSK_ALLOC_SCOPE("capture");
+    CSK_ALLOC_EVENT();
+    handleXIEvent(evtype, data);
+    finishBatch();
+}
+
+// Compares our pressed keys with the server's and fixes only the keys that differ,
+// e.g. a release lost to a grab, a VT switch or a focus change
+void ScreenKey::resync() {
+    CSK_TRACE_SCOPE("resync");
+    if (!display) {
+        return;
+    }
+    char serverKeymap[32];
+    XQueryKeymap(display, serverKeymap);
+    applyServerKeymap(serverKeymap);
+}
+
+void ScreenKey::applyServerKeymap(const char *serverKeymap) {
+    resyncCount++;
+    lastResync = std::chrono::steady_clock::now();
+
+    bool changed = false;
+    bool haveXkbState = false;
+    XkbStateRec xkbState = {};
+    for (int byte = 0; byte < 32; byte++) {
+        unsigned char diff = keymap[byte] ^ static_cast<unsigned char>(serverKeymap[byte]);
+        if (!diff) {
+            continue;
+        }
+
+        for (int bit = 0; bit < 8; bit++) {
+            if (!(diff & (1 << bit))) {
+                continue;
+            }
+            int keycode = byte * 8 + bit;
+            bool pressed = serverKeymap[byte] & (1 << bit);
+            std::string &keyStr = heldLabels[keycode];
+
+            // The server's keymap has no device, so keys found down are
+            // shown in the shared set and released keys leave every set
+            unsigned char mask = 1 << bit;
+            bool shown = !privacyActive;
+            if (pressed && privacyActive) {
+                // Held in a private window (e.g. a grabbing password dialog):
+                // tracked so its release stays consistent, never labelled or announced
+                keymap[byte] |= mask;
+            } else if (pressed) {
+                keymap[byte] |= mask;
+                if (!haveXkbState && display) {
+                    // Labelled like a press in the current group and shift level
+                    XkbGetState(display, XkbUseCoreKbd, &xkbState);
+                    haveXkbState = true;
+                }
+                keyStr = lookupKey(keycode, xkbState.group, xkbState.mods).label;
+                if (!keyStr.empty()) {
+                    state.add(keyStr);
+                }
+            } else {
+                keymap[byte] &= ~mask;
+                if (!keyStr.empty()) {
+                    state.remove(keyStr);
+                    keyStr.clear();
+                    shown = true;
+                }
+                for (auto &device : deviceStates) {
+                    std::string &held = device.second.heldLabels[keycode];
+                    device.second.keymap[byte] &= ~mask;
+                    if (!held.empty()) {
+                        device.second.state.remove(held);
+                        held.clear();
+                        shown = true;
+                    }
+                }
+            }
+            resyncFixedCount++;
+            changed = changed || shown;  // Keys hidden by privacy rules change nothing visible
+        }
+    }
+
+    if (changed) {
+        // No event carries a server time here; extrapolate from the newest one
+        Time now = lastEventTime + std::chrono::duration_cast<std::chrono::milliseconds>(
+            lastResync - lastEventAt).count();
+        lastState = &state;
+        state.emit(KEY_EVENT_RESYNC, 0, "", now);
+        for (auto &device : deviceStates) {
+            device.second.state.emit(KEY_EVENT_RESYNC, 0, "", now);
+        }
+    }
+}
+
+void ScreenKey::handleXIEvent(int evtype, void *data) {
+    XIDeviceEvent *xide = static_cast<XIDeviceEvent *>(data);
+    if (data) {
+        lastEventTime = static_cast<XIEvent *>(data)->time;  // Raw events share this header
+        lastEventAt = std::chrono::steady_clock::now();
+    }
+    if (evtype == XI_KeyPress) {
+        handleKeyPress(xide);
+    } else if (evtype == XI_KeyRelease) {
+        handleKeyRelease(xide);
+    } else if (evtype == XI_ButtonPress) {
+        handleButtonPress(xide);
+    } else if (evtype == XI_ButtonRelease) {
+        handleButtonRelease(xide);
+    } else if (evtype == XI_Motion) {
+        handleMotion(xide);
+    } else if (evtype == XI_RawTouchBegin || evtype == XI_RawTouchUpdate || evtype == XI_RawTouchEnd) {
+        handleTouch(evtype, static_cast<XIRawEvent *>(data));
+    } else if (evtype == XI_HierarchyChanged) {
+        loadDevices();
+    }
+}
+
+void ScreenKey::handleXkbEvent(int xkbType) {
+    if (xkbType == XkbMapNotify || xkbType == XkbNewKeyboardNotify) {
+        loadKeyLabels();
+    }
+}
+
+#ifndef CSK_XCB_BACKEND
+// Xlib backend; the XCB one is in ScreenKeyXcb.cpp
+
+bool ScreenKey::pending() const {
+    return display && XPending(display) > 0;
+}
+
+// True when the next queued event is also XI2 motion, so the current one can be
+// dropped without fetching its data
+bool ScreenKey::nextIsMotion() {
+    if (!XPending(display)) {
+        return false;
+    }
+    XEvent next;
+    XPeekEvent(display, &next);
+    return next.xcookie.type == GenericEvent && next.xcookie.extension == opcode &&
+           next.xcookie.evtype == XI_Motion;
+}
+
+void ScreenKey::readEvents() {
+    while (XPending(display)) {
+        CSK_ALLOC_SCOPE("capture");
+        XEvent event;
+        {
+            CSK_TRACE_SCOPE("XNextEvent");
+            XNextEvent(display, &event);
+        }
+
+        if (event.type == xkbEventBase) {
+            handleXkbEvent(reinterpret_cast<XkbAnyEvent *>(&event)->xkb_type);
+        } else if (event.type == PropertyNotify) {
+            handlePropertyEvent(event.xproperty.window, event.xproperty.atom);
+        } else if (event.xcookie.type == GenericEvent && event.xcookie.extension == opcode) {
+            if (event.xcookie.evtype == XI_Motion && nextIsMotion()) {
+                continue;  // Superseded; Xlib frees the unread cookie data
+            }
+
+            CSK_ALLOC_EVENT();
+            {
+                CSK_TRACE_SCOPE("XGetEventData");
+                XGetEventData(display, &event.xcookie);
+            }
+            handleXIEvent(event.xcookie.evtype, event.xcookie.data);
+            XFreeEventData(display, &event.xcookie);
+        }
+    }
+}
+#endif
+
+void ScreenKey::dispatch() {
+    if (!display) {
+        return;
+    }
+
+    readEvents();
+    finishBatch();
+
+    // Only resync with an empty queue, otherwise queued events would race the snapshot
+    if (focusChanged || (resyncIntervalMs > 0 &&
+        std::chrono::steady_clock::now() - lastResync >= std::chrono::milliseconds(resyncIntervalMs))) {
+        focusChanged = false;
+        resync();
+    }
+}
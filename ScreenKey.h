@@ -0,0 +1,281 @@
+#ifndef SCREENKEY_H
+#define SCREENKEY_H
+
+// libcscreenkey: X11/XInput2 key and mouse capture. Each ScreenKey instance
+// owns its display connection, labels and pressed state, so several can run in
+// one process. The caller drives it from its own event loop:
+//
+//   ScreenKey capture;
+//   capture.setListener([](const KeyEvent &event) { ... });
+//   capture.open();
+//   while (running) {
+//       pollfd fd = {capture.fd(), POLLIN, 0};
+//       poll(&fd, 1, capture.pending() ? 0 : 100);
+//       capture.dispatch();
+//   }
+//
+// Without a listener, events are queued and read with nextEvent().
+
+#include "KeyEvent.h"
+#include "KeyState.h"
+#include "KeySequence.h"
+#include "KeyStats.h"
+#include "ComposeTable.h"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <X11/Xlib.h>
+#include <X11/extensions/XInput2.h>
+
+#ifdef CSK_XCB_BACKEND
+    #include <xcb/xcb.h>
+#endif
+
+class ScreenKey {
+public:
+    ScreenKey();
+    ~ScreenKey();
+
+    ScreenKey(const ScreenKey &) = delete;
+    ScreenKey &operator=(const ScreenKey &) = delete;
+
+    // Connects to `displayName` (nullptr for $DISPLAY) and selects XI2 input on its root
+    bool open(const char *displayName = nullptr);
+    void close();
+
+    // Connection descriptor to poll for input
+    int fd() const { return display ? ConnectionNumber(display) : -1; }
+
+    // True when events are already buffered and fd() may not become readable
+    bool pending() const;
+
+    // Handles every queued event and the periodic resync; never blocks
+    void dispatch();
+
+    // Checks the pressed keys against the server and fixes the ones that differ
+    void resync();
+
+    // Forgets every pressed key and button
+    void clear();
+
+    void setListener(KeyState::Listener callback);
+    bool nextEvent(KeyEvent &event);
+
+    // Feeds one prepared XI2 event (an XIDeviceEvent, or an XIRawEvent for
+    // touches) through the same handlers dispatch() uses, as if it were the
+    // only event of a batch. For benchmarks and checks; without a display,
+    // call loadKeysyms() first.
+    void injectEvent(int evtype, void *data);
+
+    // Applies a keymap in XQueryKeymap() layout as resync() applies the
+    // server's; for checks without a display
+    void injectKeymap(const char *serverKeymap) { applyServerKeymap(serverKeymap); }
+
+    // Builds the label table from keycode -> keysym pairs (one group, one
+    // level) instead of reading the server's keyboard map
+    void loadKeysyms(const std::vector<std::pair<int, KeySym>> &keysyms);
+
+    // Gives a device a scroll valuator, as loadDevices() would from XIScrollClassInfo
+    void loadScrollAxis(int deviceId, int valuator, bool horizontal, double increment);
+
+    // Keeps a separate pressed set per physical device, so two people typing at
+    // once don't merge into one chord. combination() is then the set of the
+    // device that sent the last event.
+    void setPerDeviceState(bool enabled) { perDevice = enabled; }
+
+    // Keys typed while the focused window matches one of `rules` are neither
+    // shown nor counted. A rule is "class:GLOB" (either WM_CLASS string),
+    // "title:GLOB" or a bare GLOB for both, e.g. "class:KeePassXC" or "title:*sudo*".
+    // Matching runs only when the focus or its title changes; a keypress reads one flag.
+    void setPrivacyRules(const std::vector<std::string> &rules);
+    bool privateFocus() const { return privacyActive; }
+
+    // Name of an XI device id from the cached device table, "" when unknown
+    const char *deviceName(int deviceId) const;
+
+    SequenceMatcher &sequences() { return sequenceMatcher; }
+
+    // Per-application chord annotations ("CTRL + W  =>  Close tab"); the
+    // profile follows the focused window's WM_CLASS. Load them before open().
+    ShortcutProfiles &profiles() { return shortcutProfiles; }
+    void setStats(KeyStats *keyStats) { stats = keyStats; }  // Not owned, may be nullptr
+
+    // Shows what dead-key and Multi_key sequences compose to ("é") instead of
+    // the key that completes them. Not owned, may be nullptr and may be shared.
+    void setCompose(const ComposeTable *table) { compose = table; composeNode = ComposeTable::ROOT; }
+    void setResyncInterval(int ms) { resyncIntervalMs = ms; }
+
+    // Pixels a held button must move before it shows as a drag, 0 disables drags
+    void setDragThreshold(int pixels) { dragThreshold = pixels; }
+
+    // Replaces labels of keysyms and mouse buttons (1-9) on top of the built-in
+    // ones; an empty label hides that key or button. Rebuilds the label table.
+    void setLabels(const std::vector<std::pair<unsigned long, std::string>> &labels);
+
+    const std::map<int, std::string> &labels() const { return specialKeyMap; }
+    const std::string &combination() const { return lastState->combination(); }
+    const unsigned char *pressedKeymap() const { return keymap; }
+    unsigned long resyncRuns() const { return resyncCount; }
+    unsigned long resyncFixedKeys() const { return resyncFixedCount; }
+
+private:
+    struct KeyLabel {
+        KeySym keysym = NoSymbol;
+        std::string label;
+    };
+
+    void initializeKeyMappings();
+    std::string keyLabel(KeySym keysym);
+    void loadKeyLabels();
+    const KeyLabel &lookupKey(int keycode, int group, int mods) const;
+    void applyServerKeymap(const char *serverKeymap);
+    KeySym baseKeysym(int keycode) const;
+    std::string buttonLabel(int button);
+    uint64_t chord(XIDeviceEvent *xide, KeySym keysym) const;
+    void setKeycodePressed(int deviceId, int keycode, bool pressed);
+    void loadDevices();
+    KeyState &stateFor(int deviceId);
+    std::string &heldLabel(int deviceId, int keycode);
+
+    void handleKeyPress(XIDeviceEvent *xide);
+    void handleKeyRelease(XIDeviceEvent *xide);
+    void handleButtonPress(XIDeviceEvent *xide);
+    void handleButtonRelease(XIDeviceEvent *xide);
+    void handleMotion(XIDeviceEvent *xide);
+    void updateDrag();
+    void handleScrollValuators(XIDeviceEvent *xide);
+    void addScroll(int deviceId, int direction, double notches, Time time);
+    void updateScroll();
+    void handleTouch(int type, XIRawEvent *raw);
+    const char *classifyTouch() const;
+    void updateTouch();
+    bool nextIsMotion();
+    void finishBatch();
+
+    // Backend: reads every queued event and hands it to handleXIEvent() or
+    // handleXkbEvent(). Xlib by default; built with -DCSK_XCB_BACKEND events
+    // come from XCB and are decoded in ScreenKeyXcb.cpp without Xlib's cookies.
+    void readEvents();
+    void handleXIEvent(int evtype, void *data);
+    void handleXkbEvent(int xkbType);
+    void handlePropertyEvent(Window window, Atom atom);
+
+    void updateFocus();
+    std::string windowTitle(Window window) const;
+    bool matchesPrivacyRules() const;
+
+    Display *display = nullptr;
+#ifdef CSK_XCB_BACKEND
+    xcb_connection_t *connection = nullptr;  // Same connection as display, owns the event queue
+    mutable xcb_generic_event_t *peeked = nullptr;  // Read ahead by pending() or motion coalescing
+#endif
+    int opcode = 0;  // XInputExtension major opcode
+    std::map<int, std::string> specialKeyMap;
+
+    // Every keycode's label for each XKB group and shift level, built from the
+    // keyboard map and rebuilt only on XkbMapNotify/XkbNewKeyboardNotify. A
+    // keypress picks its label with the event's effective group and modifiers:
+    //   level = typeLevels[keyTypes[keycode][group]][mods]
+    //   label = keyLabels[keycode][group][level]
+    static const int MAX_GROUPS = 4;  // XkbNumKbdGroups
+    static const int MAX_LEVELS = 8;
+    std::vector<KeyLabel> keyLabels;  // [keycode][group][level], groups out of range already wrapped
+    std::vector<unsigned char> keyTypes;  // [keycode][group] -> key type
+    std::vector<unsigned char> typeLevels;  // [key type][real modifiers] -> level
+    std::string heldLabels[256];  // Label shown at press, so the release matches even if the level changed
+    int xkbEventBase = -1;
+    KeyState state;  // Shared by all devices unless perDevice is set; resync adds keys found down here
+    // Per-device mode: each device's own pressed set, held labels and
+    // keycodes, so two devices holding the same key release it separately
+    struct DeviceKeys {
+        KeyState state;
+        std::string heldLabels[256];
+        unsigned char keymap[32] = {};
+    };
+    std::map<int, DeviceKeys> deviceStates;  // A map, so references stay valid
+    KeyState *lastState = &state;
+    KeyState::Listener listener;
+    bool perDevice = false;
+    // Smooth-scrolling valuator of a device; its value only ever accumulates
+    struct ScrollAxis {
+        int number = -1;  // Valuator number, -1 when the device has no such axis
+        bool horizontal = false;
+        double increment = 1;  // Value change per wheel notch, negative for natural scrolling
+        double last = 0;
+    };
+    struct DeviceInfo {
+        std::string name;
+        ScrollAxis scroll[2];
+        double range[2] = {1, 1};  // Extent of valuators 0 and 1 (x, y), to scale touch movement
+    };
+    std::vector<DeviceInfo> devices;  // Indexed by XI device id, rebuilt on hierarchy changes
+    SequenceMatcher sequenceMatcher;
+    ShortcutProfiles shortcutProfiles;
+    const ShortcutProfiles::Profile *activeProfile = nullptr;  // Switched only when the focus changes
+    KeyStats *stats = nullptr;
+    const ComposeTable *compose = nullptr;
+    uint32_t composeNode = ComposeTable::ROOT;  // Position in a pending compose sequence
+    std::string composedLabel;  // Last composed text, reused so composing doesn't allocate
+
+    // Motion is coalesced: events only store the latest position and the drag
+    // check runs once per dispatch(), so at most one update per batch
+    int dragThreshold = 8;
+    int dragButton = 0;  // Button that may become a drag, 0 when none is held
+    int dragDevice = 0;
+    bool dragging = false;
+    bool motionPending = false;
+    double pressX = 0, pressY = 0;
+    double pointerX = 0, pointerY = 0;
+    Time motionTime = 0;
+
+    // Scrolling in one direction without a pause is one streak, shown as
+    // "MOUSE SCROLL DOWN ×8" and updated at most once per dispatch()
+    static const Time SCROLL_STREAK_MS = 800;
+    int scrollDirection = -1;  // 0 up, 1 down, 2 left, 3 right (buttons 4-7)
+    int scrollDevice = 0;
+    double scrollNotches = 0;
+    int scrollShown = 0;  // Whole notches already reported for this streak
+    bool scrollPending = false;
+    Time scrollTime = 0;
+
+    // Touch: raw touch events only store positions in fixed slots, and the
+    // gesture (tap, drag, two-finger scroll, pinch) is classified once per
+    // dispatch(), so updates never allocate or redraw by themselves
+    static const int MAX_TOUCHES = 10;
+    struct TouchPoint {
+        int id;
+        bool active;  // A finger is down in this slot; the slot is free again once it lifts
+        double startX, startY, x, y;  // Device units
+    };
+    TouchPoint touches[MAX_TOUCHES] = {};
+    bool touchSupported = false;  // The server speaks XI 2.2
+    int touchCount = 0;  // Fingers down now
+    int touchMaxCount = 0;  // Most fingers down at once during this gesture
+    int touchDevice = 0;
+    Time touchStart = 0, touchTime = 0;
+    const char *touchGesture = nullptr;  // Shown label, nullptr until recognised
+    bool touchPending = false;
+    bool touchEnded = false;
+
+    // Focused window, followed through PropertyNotify on the root
+    // (_NET_ACTIVE_WINDOW) and on the window itself (its title)
+    Atom netActiveWindow = None, netWmName = None, utf8String = None;
+    Window activeWindow = None;
+    std::string activeClass[2];  // WM_CLASS instance and class names
+    std::string activeTitle;
+    std::vector<std::string> privacyRules;
+    bool privacyActive = false;  // The focused window matches a privacy rule
+
+    unsigned char keymap[32];  // Keycodes we believe are down on any device, same layout as XQueryKeymap()
+    int resyncIntervalMs = 2000;  // Interval between periodic checks of the pressed state, 0 disables
+    std::chrono::steady_clock::time_point lastResync;
+    Time lastEventTime = 0;  // Server time of the newest XI2 event, to stamp resync records with
+    std::chrono::steady_clock::time_point lastEventAt;
+    bool focusChanged = false;  // A focus switch is where releases usually get lost; resync once the queue is drained
+    unsigned long resyncCount = 0;
+    unsigned long resyncFixedCount = 0;
+};
+
+#endif
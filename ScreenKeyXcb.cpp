@@ -0,0 +1,203 @@
+// XCB capture backend for ScreenKey, compiled with -DCSK_XCB_BACKEND (link
+// -lX11-xcb -lxcb). Xlib still opens the connection and makes the requests
+// (XKB map, device list, keymap), but XCB owns the event queue: events are
+// taken with xcb_poll_for_event() and the XI2 wire format is decoded on the
+// stack, so there is no XGetEventData() cookie to allocate, copy and free.
+
+#ifdef CSK_XCB_BACKEND
+
+#include "ScreenKey.h"
+#include "AllocTracker.h"
+#include "Trace.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <X11/XKBlib.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/extensions/XI2proto.h>
+
+namespace {
+
+// XCB stores full_sequence after the first 32 bytes of an event, so the rest
+// of a generic event sits 4 bytes later than in the XI2proto.h structs
+const size_t WIRE_HEADER = 32;
+const size_t XCB_TAIL = 36;
+
+const int MAX_VALUATORS = 64;
+
+// Decoded valuators, on the caller's stack
+struct Valuators {
+    unsigned char mask[MAX_VALUATORS / 8];
+    double values[MAX_VALUATORS];
+};
+
+double fromFP1616(FP1616 value) {
+    return value / 65536.0;
+}
+
+double fromFP3232(const FP3232 &value) {
+    return value.integral + value.frac / 4294967296.0;
+}
+
+// Copies a wire struct out of an XCB event, skipping full_sequence
+template <typename Wire>
+void readWire(const xcb_generic_event_t *event, Wire &wire) {
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(event);
+    std::memcpy(&wire, bytes, WIRE_HEADER);
+    if (sizeof(wire) > WIRE_HEADER) {
+        std::memcpy(reinterpret_cast<unsigned char *>(&wire) + WIRE_HEADER, bytes + XCB_TAIL,
+                    sizeof(wire) - WIRE_HEADER);
+    }
+}
+
+// Decodes a valuator mask and the FP3232 values that follow it; valuators past
+// MAX_VALUATORS are ignored, nothing here uses them
+const unsigned char *readValuators(const unsigned char *data, int maskWords, Valuators &out,
+                                   XIValuatorState &state) {
+    const unsigned char *mask = data;
+    const FP3232 *wireValues = reinterpret_cast<const FP3232 *>(data + maskWords * 4);
+
+    int maskBytes = maskWords * 4 < static_cast<int>(sizeof(out.mask)) ? maskWords * 4 : sizeof(out.mask);
+    std::memcpy(out.mask, mask, maskBytes);
+
+    int count = 0, wireIndex = 0;
+    for (int bit = 0; bit < maskWords * 32; bit++) {
+        if (!XIMaskIsSet(mask, bit)) {
+            continue;
+        }
+        if (bit < MAX_VALUATORS) {
+            FP3232 value;
+            std::memcpy(&value, wireValues + wireIndex, sizeof(value));
+            out.values[count++] = fromFP3232(value);
+        }
+        wireIndex++;
+    }
+
+    state.mask_len = maskBytes;
+    state.mask = out.mask;
+    state.values = out.values;
+    return reinterpret_cast<const unsigned char *>(wireValues + wireIndex);
+}
+
+}
+
+bool ScreenKey::pending() const {
+    if (!connection) {
+        return false;
+    }
+    if (!peeked) {
+        peeked = xcb_poll_for_queued_event(connection);
+    }
+    return peeked != nullptr;
+}
+
+// True when the next already-received event is also XI2 motion
+bool ScreenKey::nextIsMotion() {
+    if (!peeked) {
+        peeked = xcb_poll_for_queued_event(connection);
+    }
+    if (!peeked || (peeked->response_type & 0x7f) != XCB_GE_GENERIC) {
+        return false;
+    }
+    const xcb_ge_generic_event_t *next = reinterpret_cast<const xcb_ge_generic_event_t *>(peeked);
+    return next->extension == opcode && next->event_type == XI_Motion;
+}
+
+void ScreenKey::readEvents() {
+    while (true) {
+        CSK_ALLOC_SCOPE("capture");
+        xcb_generic_event_t *event = peeked;
+        peeked = nullptr;
+        if (!event) {
+            CSK_TRACE_SCOPE("xcb_poll_for_event");
+            event = xcb_poll_for_event(connection);
+        }
+        if (!event) {
+            break;
+        }
+
+        int type = event->response_type & 0x7f;
+        if (type == xkbEventBase) {
+            handleXkbEvent(reinterpret_cast<const unsigned char *>(event)[1]);  // xkbType follows the type byte
+        } else if (type == XCB_PROPERTY_NOTIFY) {
+            const xcb_property_notify_event_t *property = reinterpret_cast<xcb_property_notify_event_t *>(event);
+            handlePropertyEvent(property->window, property->atom);
+        } else if (type == XCB_GE_GENERIC &&
+                   reinterpret_cast<xcb_ge_generic_event_t *>(event)->extension == opcode) {
+            int evtype = reinterpret_cast<xcb_ge_generic_event_t *>(event)->event_type;
+            if (evtype == XI_Motion && nextIsMotion()) {
+                std::free(event);  // Superseded by the queued motion
+                continue;
+            }
+
+            CSK_ALLOC_EVENT();
+            CSK_TRACE_SCOPE("decodeXIEvent");
+            const unsigned char *bytes = reinterpret_cast<const unsigned char *>(event);
+            Valuators valuators;
+
+            if (evtype == XI_KeyPress || evtype == XI_KeyRelease || evtype == XI_ButtonPress ||
+                evtype == XI_ButtonRelease || evtype == XI_Motion) {
+                xXIDeviceEvent wire;
+                readWire(event, wire);
+
+                XIDeviceEvent xide;
+                std::memset(&xide, 0, sizeof(xide));
+                xide.type = GenericEvent;
+                xide.extension = opcode;
+                xide.evtype = evtype;
+                xide.display = display;
+                xide.time = wire.time;
+                xide.deviceid = wire.deviceid;
+                xide.sourceid = wire.sourceid;
+                xide.detail = wire.detail;
+                xide.root = wire.root;
+                xide.event = wire.event;
+                xide.child = wire.child;
+                xide.root_x = fromFP1616(wire.root_x);
+                xide.root_y = fromFP1616(wire.root_y);
+                xide.event_x = fromFP1616(wire.event_x);
+                xide.event_y = fromFP1616(wire.event_y);
+                xide.flags = wire.flags;
+                xide.mods.base = wire.mods.base_mods;
+                xide.mods.latched = wire.mods.latched_mods;
+                xide.mods.locked = wire.mods.locked_mods;
+                xide.mods.effective = wire.mods.effective_mods;
+                xide.group.base = wire.group.base_group;
+                xide.group.latched = wire.group.latched_group;
+                xide.group.locked = wire.group.locked_group;
+                xide.group.effective = wire.group.effective_group;
+
+                // Button mask, then valuator mask and values
+                const unsigned char *buttons = bytes + XCB_TAIL + (sizeof(wire) - WIRE_HEADER);
+                xide.buttons.mask_len = wire.buttons_len * 4;
+                xide.buttons.mask = const_cast<unsigned char *>(buttons);
+                readValuators(buttons + wire.buttons_len * 4, wire.valuators_len, valuators, xide.valuators);
+
+                handleXIEvent(evtype, &xide);
+            } else if (evtype == XI_RawTouchBegin || evtype == XI_RawTouchUpdate || evtype == XI_RawTouchEnd) {
+                xXIRawEvent wire;
+                readWire(event, wire);
+
+                XIRawEvent raw;
+                std::memset(&raw, 0, sizeof(raw));
+                raw.type = GenericEvent;
+                raw.extension = opcode;
+                raw.evtype = evtype;
+                raw.display = display;
+                raw.time = wire.time;
+                raw.deviceid = wire.deviceid;
+                raw.sourceid = wire.sourceid;
+                raw.detail = wire.detail;
+                raw.flags = wire.flags;
+                readValuators(bytes + XCB_TAIL, wire.valuators_len, valuators, raw.valuators);
+
+                handleXIEvent(evtype, &raw);
+            } else {
+                handleXIEvent(evtype, nullptr);  // Focus, crossing and hierarchy events carry nothing we read
+            }
+        }
+        std::free(event);
+    }
+}
+
+#endif
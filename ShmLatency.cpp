@@ -0,0 +1,72 @@
+// Measures publish-to-read latency of the shared-memory event ring: one thread
+// publishes events through ShmPublisher while another follows them through
+// ShmReader, exactly as a separate consumer process would.
+//
+//   g++ -O2 ShmLatency.cpp ShmRing.cpp -o shm_latency -lpthread -lrt
+//   ./shm_latency [events]
+
+#include "ShmRing.h"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <chrono>
+
+int main(int argc, char *argv[]) {
+    const int events = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const std::string name = "/cscreenkey-latency-" + std::to_string(getpid());
+
+    ShmPublisher publisher;
+    if (!publisher.open(name)) {
+        return 1;
+    }
+
+    ShmReader reader;
+    if (!reader.open(name)) {
+        std::cerr << "Cannot map " << name << " for reading" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(events);
+    std::thread consumer([&] {
+        KeyEvent event;
+        uint64_t publishTime;
+        while (latencies.size() + reader.lostEvents() < static_cast<size_t>(events)) {
+            if (reader.next(event, &publishTime)) {
+                latencies.push_back(shmMonotonicNs() - publishTime);
+            }
+        }
+    });
+
+    unsigned char keymap[32] = {0};
+    KeyEvent event = {};
+    copyEventText(event.label, sizeof(event.label), "a");
+    copyEventText(event.combination, sizeof(event.combination), "Control_L + a");
+    for (int i = 0; i < events; i++) {
+        event.time = i;
+        event.type = i % 2 ? KEY_EVENT_RELEASE : KEY_EVENT_PRESS;
+        event.detail = 38;
+        publisher.publish(event, keymap);
+
+        // Space events out like very fast typing rather than a tight loop
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    consumer.join();
+
+    if (latencies.empty()) {
+        std::cerr << "No events read" << std::endl;
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+
+    std::cout << "events " << events << ", read " << latencies.size() << ", lost " << reader.lostEvents() << "\n"
+              << "latency ns: min " << latencies.front() << ", p50 " << percentile(0.5)
+              << ", p99 " << percentile(0.99) << ", max " << latencies.back() << std::endl;
+
+    // Fail when the reader could not keep up with a plain typing rate
+    return reader.lostEvents() == 0 ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#include "ShmRing.h"
+
+#include <iostream>
+#include <cerrno>
+
+ShmPublisher::~ShmPublisher() {
+    if (header) {
+        munmap(header, size);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool ShmPublisher::open(const std::string &shmName, uint32_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        std::cerr << "Shared memory ring capacity must be a power of two" << std::endl;
+        return false;
+    }
+
+    name = shmName;
+    size = shmRingSize(capacity);
+
+    shm_unlink(name.c_str());  // Readers of a previous run keep their old mapping
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        std::cerr << "Cannot create shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        if (fd >= 0) {
+            ::close(fd);
+            shm_unlink(name.c_str());
+        }
+        return false;
+    }
+
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Cannot map shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // ftruncate() zero-fills, so every slot starts with seq 0 (never written)
+    header = static_cast<ShmRingHeader *>(memory);
+    slots = reinterpret_cast<ShmSlot *>(header + 1);
+    header->capacity = capacity;
+    header->slotSize = sizeof(ShmSlot);
+    header->version = SHM_RING_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHM_RING_MAGIC;
+    return true;
+}
+
+void ShmPublisher::publish(const KeyEvent &event, const unsigned char keymap[32]) {
+    uint64_t index = header->published.load(std::memory_order_relaxed);
+    ShmSlot &slot = slots[index & (header->capacity - 1)];
+
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&slot.event, &event, sizeof(event));
+    slot.publishTime = shmMonotonicNs();
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+
+    uint64_t stateSeq = header->stateSeq.load(std::memory_order_relaxed);
+    header->stateSeq.store(stateSeq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    header->state.time = event.time;
+    std::memcpy(header->state.keymap, keymap, sizeof(header->state.keymap));
+    std::memcpy(header->state.combination, event.combination, sizeof(header->state.combination));
+    header->stateSeq.store(stateSeq + 2, std::memory_order_release);
+
+    header->published.store(index + 1, std::memory_order_release);
+}
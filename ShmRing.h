@@ -0,0 +1,180 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+// Shared-memory publication of key events. The writer (ShmPublisher, in the
+// capture process) and any number of readers (ShmReader, header-only so other
+// tools only need this file and KeyEvent.h) share one POSIX shm object:
+//
+//   ShmRingHeader | ShmSlot[capacity]
+//
+// Each slot and the pressed-state snapshot are guarded by a sequence lock, so
+// readers never make a syscall after mapping and never block the writer. A
+// reader that falls more than `capacity` events behind skips ahead and counts
+// the lost events.
+
+#include "KeyEvent.h"
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint32_t SHM_RING_MAGIC = 0x4B53434B;  // "KCSK"
+static const uint32_t SHM_RING_VERSION = 3;  // 2: KeyEvent::source, 3: KeyEvent::device
+
+struct ShmState {
+    uint64_t time;             // X server time of the last event
+    unsigned char keymap[32];  // Pressed keycodes, XQueryKeymap() layout
+    char combination[192];     // Same text as KeyEvent::combination
+};
+
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;                 // Number of slots, a power of two
+    uint32_t slotSize;
+    std::atomic<uint64_t> published;   // Events written so far
+    std::atomic<uint64_t> stateSeq;    // Odd while the snapshot is being written
+    ShmState state;
+};
+
+struct ShmSlot {
+    std::atomic<uint64_t> seq;  // 2n+1 while event n is written, 2n+2 once complete
+    uint64_t publishTime;       // CLOCK_MONOTONIC nanoseconds when published
+    KeyEvent event;
+};
+
+inline uint64_t shmMonotonicNs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+inline size_t shmRingSize(uint32_t capacity) {
+    return sizeof(ShmRingHeader) + capacity * sizeof(ShmSlot);
+}
+
+// Writer side, lives in the capture process
+class ShmPublisher {
+public:
+    ~ShmPublisher();
+
+    // Creates (or replaces) the shm object `name`, e.g. "/cscreenkey"
+    bool open(const std::string &name, uint32_t capacity = 1024);
+
+    void publish(const KeyEvent &event, const unsigned char keymap[32]);
+
+private:
+    std::string name;
+    ShmRingHeader *header = nullptr;
+    ShmSlot *slots = nullptr;
+    size_t size = 0;
+};
+
+// Reader side: maps the ring read-only and follows it from the newest event
+class ShmReader {
+public:
+    ~ShmReader() {
+        if (header) {
+            munmap(const_cast<ShmRingHeader *>(header), size);
+        }
+    }
+
+    bool open(const std::string &name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < sizeof(ShmRingHeader)) {
+            ::close(fd);
+            return false;
+        }
+
+        size = info.st_size;
+        void *memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+
+        header = static_cast<ShmRingHeader *>(memory);
+        if (header->magic != SHM_RING_MAGIC || header->version != SHM_RING_VERSION ||
+            header->slotSize != sizeof(ShmSlot) || shmRingSize(header->capacity) > size) {
+            munmap(memory, size);
+            header = nullptr;
+            return false;
+        }
+
+        slots = reinterpret_cast<const ShmSlot *>(header + 1);
+        cursor = header->published.load(std::memory_order_acquire);
+        return true;
+    }
+
+    // Copies the next unread event; returns false when there is none yet
+    bool next(KeyEvent &event, uint64_t *publishTime = nullptr) {
+        while (true) {
+            uint64_t published = header->published.load(std::memory_order_acquire);
+            if (cursor >= published) {
+                return false;
+            }
+            if (published - cursor > header->capacity) {
+                lost += published - cursor - header->capacity;  // Overwritten before we got to them
+                cursor = published - header->capacity;
+            }
+
+            const ShmSlot &slot = slots[cursor & (header->capacity - 1)];
+            uint64_t expected = 2 * cursor + 2;
+            uint64_t before = slot.seq.load(std::memory_order_acquire);
+            if (before == expected) {
+                std::memcpy(&event, &slot.event, sizeof(event));
+                uint64_t time = slot.publishTime;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) == expected) {
+                    if (publishTime) {
+                        *publishTime = time;
+                    }
+                    cursor++;
+                    return true;
+                }
+            }
+            if (before > expected) {
+                lost++;  // The writer lapped us while copying
+                cursor++;
+            }
+            // Otherwise the slot is still being written; try again
+        }
+    }
+
+    // Copies a consistent pressed-state snapshot
+    void state(ShmState &out) const {
+        while (true) {
+            uint64_t before = header->stateSeq.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            std::memcpy(&out, &header->state, sizeof(out));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->stateSeq.load(std::memory_order_relaxed) == before) {
+                return;
+            }
+        }
+    }
+
+    uint64_t lostEvents() const { return lost; }
+
+private:
+    const ShmRingHeader *header = nullptr;
+    const ShmSlot *slots = nullptr;
+    size_t size = 0;
+    uint64_t cursor = 0;
+    uint64_t lost = 0;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "SnapshotHub.h"
+#include "Trace.h"
+
+SnapshotHub::~SnapshotHub() {
+    stop();
+}
+
+size_t SnapshotHub::subscribeLatest(const std::string &name, int intervalMs, Sink sink) {
+    return subscribe(name, false, intervalMs, std::move(sink));
+}
+
+size_t SnapshotHub::subscribeEvery(const std::string &name, Sink sink) {
+    return subscribe(name, true, 0, std::move(sink));
+}
+
+size_t SnapshotHub::subscribe(const std::string &name, bool every, int intervalMs, Sink sink) {
+    std::unique_ptr<Subscriber> subscriber(new Subscriber());
+    subscriber->name = name;
+    subscriber->every = every;
+    subscriber->intervalMs = intervalMs;
+    subscriber->sink = std::move(sink);
+    subscriber->ring.resize(every ? QUEUE_CAPACITY : 1);
+    subscribers.push_back(std::move(subscriber));
+    return subscribers.size() - 1;
+}
+
+void SnapshotHub::setInterval(size_t index, int intervalMs) {
+    subscribers[index]->intervalMs = intervalMs;
+}
+
+void SnapshotHub::start() {
+    if (started) {
+        return;
+    }
+    started = true;
+    for (auto &subscriber : subscribers) {
+        Subscriber *target = subscriber.get();
+        subscriber->thread = std::thread([this, target] { run(*target); });
+    }
+}
+
+void SnapshotHub::publish(const std::string &text) {
+    CSK_TRACE_SCOPE("publish");
+    sequence++;
+    auto now = std::chrono::system_clock::now();
+    for (auto &subscriber : subscribers) {
+        bool wasEmpty;
+        {
+            std::lock_guard<std::mutex> lock(subscriber->mutex);
+            size_t capacity = subscriber->ring.size();
+            if (subscriber->count == capacity) {
+                // A latest sink only wants the newest; an every sink loses its oldest
+                subscriber->head = (subscriber->head + 1) % capacity;
+                subscriber->count--;
+                if (subscriber->every) {
+                    subscriber->dropped++;
+                } else {
+                    subscriber->skipped++;
+                }
+            }
+            Snapshot &slot = subscriber->ring[(subscriber->head + subscriber->count) % capacity];
+            slot.sequence = sequence;
+            slot.time = now;
+            slot.text.assign(text);  // Reuses the slot's buffer
+            wasEmpty = subscriber->count++ == 0;
+        }
+        // A sink with snapshots pending is either drawing or waiting out its interval
+        if (wasEmpty) {
+            subscriber->wake.notify_one();
+        }
+    }
+}
+
+void SnapshotHub::stop() {
+    if (!started) {
+        return;
+    }
+    for (auto &subscriber : subscribers) {
+        {
+            std::lock_guard<std::mutex> lock(subscriber->mutex);
+            subscriber->stopping = true;
+        }
+        subscriber->wake.notify_one();
+    }
+    for (auto &subscriber : subscribers) {
+        subscriber->thread.join();
+    }
+    started = false;
+}
+
+SnapshotHub::Stats SnapshotHub::stats(size_t index) const {
+    Subscriber &subscriber = *subscribers[index];
+    std::lock_guard<std::mutex> lock(subscriber.mutex);
+    return {subscriber.name, subscriber.delivered, subscriber.skipped, subscriber.dropped};
+}
+
+void SnapshotHub::run(Subscriber &subscriber) {
+    traceSetThreadName(subscriber.name.c_str());
+    Snapshot snapshot;
+    std::chrono::steady_clock::time_point lastDelivery;
+
+    std::unique_lock<std::mutex> lock(subscriber.mutex);
+    while (true) {
+        subscriber.wake.wait(lock, [&] { return subscriber.count > 0 || subscriber.stopping; });
+        if (subscriber.count == 0) {
+            return;  // Stopping with nothing left to deliver
+        }
+        if (!subscriber.every) {
+            // Newer snapshots keep replacing the slot while the interval runs out
+            auto due = lastDelivery + std::chrono::milliseconds(subscriber.intervalMs.load());
+            subscriber.wake.wait_until(lock, due, [&] { return subscriber.stopping; });
+        }
+
+        // Swapped, not copied: the slot keeps the previous snapshot's buffer
+        std::swap(snapshot, subscriber.ring[subscriber.head]);
+        subscriber.head = (subscriber.head + 1) % subscriber.ring.size();
+        subscriber.count--;
+
+        lock.unlock();
+        {
+            CSK_TRACE_SCOPE("sink");
+            subscriber.sink(snapshot);
+        }
+        lastDelivery = std::chrono::steady_clock::now();
+        lock.lock();
+        subscriber.delivered++;
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef SNAPSHOTHUB_H
+#define SNAPSHOTHUB_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// What the display shows after an event
+struct Snapshot {
+    uint64_t sequence = 0;  // Increases with every publish()
+    std::chrono::system_clock::time_point time;  // Wall clock, for sinks that log
+    std::string text;  // The shown keys, "" when the view is clear
+};
+
+// Fans snapshots out to several sinks (terminal view, overlay, log), each on
+// its own thread and pace. publish() only copies the snapshot into each
+// sink's slot under a lock the sink holds just as long as it takes to copy
+// it out, so a sink that is slow to draw or write never delays capture or
+// the other sinks.
+//
+// A "latest" sink gets the newest snapshot at most once per interval; the
+// ones it was too slow or too paced to see are skipped. An "every" sink gets
+// each snapshot in order from a ring of QUEUE_CAPACITY; when it falls that
+// far behind the oldest are dropped. The strings in the slots are reused, so
+// steady-state publishing doesn't allocate.
+class SnapshotHub {
+public:
+    using Sink = std::function<void(const Snapshot &snapshot)>;
+    static const size_t QUEUE_CAPACITY = 256;
+
+    struct Stats {
+        std::string name;
+        unsigned long delivered;
+        unsigned long skipped;  // Replaced by a newer snapshot before delivery ("latest" sinks)
+        unsigned long dropped;  // Lost to a full queue ("every" sinks)
+    };
+
+    ~SnapshotHub();
+
+    // Registers a sink before start(); returns its index. intervalMs 0 delivers as soon as possible.
+    size_t subscribeLatest(const std::string &name, int intervalMs, Sink sink);
+    size_t subscribeEvery(const std::string &name, Sink sink);
+
+    // Changes the pace of a "latest" sink; takes effect from its next delivery
+    void setInterval(size_t index, int intervalMs);
+
+    // Starts one thread per sink
+    void start();
+
+    // Called from the capture thread; never waits on a sink
+    void publish(const std::string &text);
+
+    // Delivers what is still pending, without pacing, and joins the sink threads
+    void stop();
+
+    size_t size() const { return subscribers.size(); }
+    Stats stats(size_t index) const;
+
+private:
+    struct Subscriber {
+        std::string name;
+        bool every;
+        std::atomic<int> intervalMs;
+        Sink sink;
+        std::thread thread;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<Snapshot> ring;  // One slot for "latest" sinks
+        size_t head = 0, count = 0;
+        bool stopping = false;
+        unsigned long delivered = 0, skipped = 0, dropped = 0;
+    };
+
+    size_t subscribe(const std::string &name, bool every, int intervalMs, Sink sink);
+    void run(Subscriber &subscriber);
+
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    uint64_t sequence = 0;
+    bool started = false;
+};
+
+#endif
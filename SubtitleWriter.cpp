@@ -0,0 +1,155 @@
+#include "SubtitleWriter.h"
+
+#include <iostream>
+
+static bool endsWith(const std::string &text, const std::string &suffix) {
+    return text.size() >= suffix.size() &&
+           text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+SubtitleWriter::~SubtitleWriter() {
+    close();
+}
+
+bool SubtitleWriter::open(const std::string &path) {
+    if (endsWith(path, ".vtt")) {
+        format = WEBVTT;
+    } else if (endsWith(path, ".ass") || endsWith(path, ".ssa")) {
+        format = ASS;
+    } else {
+        format = SRT;
+    }
+
+    file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        std::cerr << "Cannot write subtitles to " << path << std::endl;
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 64 * 1024);
+
+    openedAt = std::chrono::steady_clock::now();
+    writeHeader();
+    std::fflush(file);
+    return true;
+}
+
+void SubtitleWriter::writeHeader() {
+    if (format == WEBVTT) {
+        std::fputs("WEBVTT\n\n", file);
+    } else if (format == ASS) {
+        std::fputs("[Script Info]\n"
+                   "ScriptType: v4.00+\n"
+                   "PlayResX: 1920\n"
+                   "PlayResY: 1080\n"
+                   "\n"
+                   "[V4+ Styles]\n"
+                   "Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, "
+                   "Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, "
+                   "Shadow, Alignment, MarginL, MarginR, MarginV, Encoding\n"
+                   "Style: Default,Monospace,48,&H00FFFFFF,&H00FFFFFF,&H00000000,&H80000000,"
+                   "-1,0,0,0,100,100,0,0,3,2,0,2,20,20,40,1\n"
+                   "\n"
+                   "[Events]\n"
+                   "Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n",
+                   file);
+    }
+}
+
+std::string SubtitleWriter::formatTime(uint64_t ms) const {
+    unsigned long hours = ms / 3600000, minutes = ms / 60000 % 60, seconds = ms / 1000 % 60;
+    char text[32];
+    if (format == ASS) {
+        std::snprintf(text, sizeof(text), "%lu:%02lu:%02lu.%02lu", hours, minutes, seconds,
+                      static_cast<unsigned long>(ms % 1000 / 10));
+    } else {
+        std::snprintf(text, sizeof(text), "%02lu:%02lu:%02lu%c%03lu", hours, minutes, seconds,
+                      format == SRT ? ',' : '.', static_cast<unsigned long>(ms % 1000));
+    }
+    return text;
+}
+
+std::string SubtitleWriter::escape(const std::string &text) const {
+    std::string result;
+    for (char c : text) {
+        if (format == WEBVTT && c == '&') {
+            result += "&amp;";
+        } else if (format == WEBVTT && c == '<') {
+            result += "&lt;";
+        } else if (format == ASS && (c == '{' || c == '}')) {
+            result += '\\';  // Would start an override block
+            result += c;
+        } else if (c == '\n') {
+            result += format == ASS ? "\\N" : " ";
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+void SubtitleWriter::writePending(uint64_t end) {
+    if (pendingText.empty()) {
+        return;
+    }
+    if (end <= pendingStart) {
+        end = pendingStart + 1;
+    }
+
+    cueCount++;
+    std::string text = escape(pendingText);
+    if (format == ASS) {
+        std::fprintf(file, "Dialogue: 0,%s,%s,Default,,0,0,0,,%s\n",
+                     formatTime(pendingStart).c_str(), formatTime(end).c_str(), text.c_str());
+    } else {
+        if (format == SRT) {
+            std::fprintf(file, "%lu\n", cueCount);
+        }
+        std::fprintf(file, "%s --> %s\n%s\n\n",
+                     formatTime(pendingStart).c_str(), formatTime(end).c_str(), text.c_str());
+    }
+    std::fflush(file);
+    pendingText.clear();
+}
+
+void SubtitleWriter::show(const std::string &text, unsigned long timeMs) {
+    if (!file) {
+        return;
+    }
+
+    // Map the first timestamp onto the writer's own clock
+    if (!haveBase) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - openedAt).count();
+        timeBase = static_cast<int64_t>(timeMs) - elapsed;
+        haveBase = true;
+    }
+    int64_t relative = static_cast<int64_t>(timeMs) - timeBase;
+    uint64_t now = relative > 0 ? relative : 0;
+
+    if (text.empty()) {
+        // Everything released: the cue stays up for its linger time unless another one starts sooner
+        if (!pendingText.empty() && pendingEnd == 0) {
+            pendingEnd = now + lingerMs;
+        }
+        return;
+    }
+
+    if (text == pendingText && (pendingEnd == 0 || now <= pendingEnd)) {
+        pendingEnd = 0;  // Pressed again before the cue ended, keep showing it
+        return;
+    }
+
+    writePending(pendingEnd && pendingEnd < now ? pendingEnd : now);
+    pendingText = text;
+    pendingStart = now;
+    pendingEnd = 0;
+}
+
+void SubtitleWriter::close() {
+    if (!file) {
+        return;
+    }
+    writePending(pendingEnd ? pendingEnd : pendingStart + lingerMs);
+    std::fclose(file);
+    file = nullptr;
+}
@@ -0,0 +1,51 @@
+#ifndef SUBTITLEWRITER_H
+#define SUBTITLEWRITER_H
+
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+// Turns the displayed key combinations into timed subtitle cues (SRT, WebVTT
+// or ASS, picked from the file extension). Only the cue on screen is kept in
+// memory: it is written once the next cue starts or its linger time runs out,
+// and the file is flushed after every cue, so long sessions use constant memory
+// and a crash loses at most the last cue.
+class SubtitleWriter {
+public:
+    enum Format { SRT, WEBVTT, ASS };
+
+    ~SubtitleWriter();
+
+    bool open(const std::string &path);
+    void setLinger(unsigned long ms) { lingerMs = ms; }
+
+    // Shows `text` from `timeMs` on, in steady_clock milliseconds; the first
+    // call is mapped onto the time since open(). An empty text means every key
+    // was released, which ends the current cue after its linger time
+    void show(const std::string &text, unsigned long timeMs);
+
+    void close();
+
+private:
+    void writeHeader();
+    void writePending(uint64_t end);
+    std::string formatTime(uint64_t ms) const;
+    std::string escape(const std::string &text) const;
+
+    std::FILE *file = nullptr;
+    Format format = SRT;
+    unsigned long lingerMs = 1500;
+
+    // Cue times count from when the writer was opened
+    std::chrono::steady_clock::time_point openedAt;
+    bool haveBase = false;
+    int64_t timeBase = 0;
+
+    std::string pendingText;
+    uint64_t pendingStart = 0;
+    uint64_t pendingEnd = 0;  // 0 while keys are still held
+    unsigned long cueCount = 0;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "TextWidth.h"
+
+#include <mutex>
+#include <cwchar>
+#include <unordered_map>
+
+// Column widths of non-ASCII texts already shown; labels and combinations
+// repeat, so each is measured once
+static std::mutex widthMutex;
+static std::unordered_map<std::string, int> widthCache;
+static const size_t MAX_CACHED_WIDTHS = 1024;
+
+// Columns taken by one UTF-8 character; `length` receives its size in bytes
+static int charColumns(const char *text, size_t available, size_t &length) {
+    std::mbstate_t state = std::mbstate_t();
+    wchar_t wide;
+    length = std::mbrtowc(&wide, text, available, &state);
+    if (length == static_cast<size_t>(-1) || length == static_cast<size_t>(-2) || length == 0) {
+        length = 1;  // Invalid byte: skip it, terminals show it as one cell
+        return 1;
+    }
+#ifdef _WIN32
+    return 1;  // No wcwidth(); count code points
+#else
+    int columns = wcwidth(wide);
+    return columns < 0 ? 0 : columns;
+#endif
+}
+
+static bool isAscii(const std::string &text) {
+    for (unsigned char c : text) {
+        if (c >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int textColumns(const std::string &text) {
+    if (isAscii(text)) {
+        return text.size();
+    }
+
+    std::lock_guard<std::mutex> lock(widthMutex);
+    auto cached = widthCache.find(text);
+    if (cached != widthCache.end()) {
+        return cached->second;
+    }
+
+    int columns = 0;
+    size_t length;
+    for (size_t i = 0; i < text.size(); i += length) {
+        columns += charColumns(text.data() + i, text.size() - i, length);
+    }
+    if (widthCache.size() >= MAX_CACHED_WIDTHS) {
+        widthCache.clear();
+    }
+    widthCache.emplace(text, columns);
+    return columns;
+}
+
+std::string truncateText(const std::string &text, int maxColumns, int &columns) {
+    static const char ELLIPSIS[] = "\u2026";
+    columns = 0;
+    if (maxColumns < 1) {
+        return "";
+    }
+
+    size_t end = 0, length;
+    while (end < text.size()) {
+        int width = charColumns(text.data() + end, text.size() - end, length);
+        if (columns + width > maxColumns - 1) {
+            break;
+        }
+        columns += width;
+        end += length;
+    }
+    columns++;
+    return text.substr(0, end) + ELLIPSIS;
+}
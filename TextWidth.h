@@ -0,0 +1,16 @@
+#ifndef TEXTWIDTH_H
+#define TEXTWIDTH_H
+
+#include <string>
+
+// Terminal column widths of UTF-8 text, shared by the terminal renderers.
+// Needs a UTF-8 locale (setlocale(LC_ALL, "") in main()) for anything beyond ASCII.
+
+// Columns `text` takes on screen; non-ASCII texts are measured once and cached. Thread-safe.
+int textColumns(const std::string &text);
+
+// Cuts `text` at a character boundary so it fits in `maxColumns` with a
+// trailing ellipsis; `columns` receives the width of the result
+std::string truncateText(const std::string &text, int maxColumns, int &columns);
+
+#endif
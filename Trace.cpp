@@ -0,0 +1,136 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <iostream>
+
+bool traceEnabled = false;
+
+namespace {
+
+struct TraceRecord {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+// Written only by its thread; traceWrite() reads it through `written`
+struct TraceBuffer {
+    int tid;
+    const char *threadName;
+    std::vector<TraceRecord> records;  // Ring of `capacity` spans, a power of two
+    std::atomic<uint64_t> written;     // Spans recorded so far
+};
+
+std::mutex buffersMutex;  // Only taken when a thread records its first span and by traceWrite()
+std::vector<TraceBuffer *> buffers;  // Kept after their threads exit so their spans can be written
+unsigned long capacity = 65536;
+uint64_t traceOrigin = 0;
+thread_local TraceBuffer *threadBuffer = nullptr;
+thread_local const char *threadName = nullptr;
+
+TraceBuffer *registerThread() {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    TraceBuffer *buffer = new TraceBuffer();
+    buffer->tid = static_cast<int>(buffers.size()) + 1;
+    buffer->threadName = threadName;
+    buffer->records.resize(capacity);
+    buffer->written.store(0);
+    buffers.push_back(buffer);
+    return buffer;
+}
+
+void writeJsonString(std::FILE *file, const char *text) {
+    std::fputc('"', file);
+    for (const char *c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            std::fputc('\\', file);
+        }
+        std::fputc(*c, file);
+    }
+    std::fputc('"', file);
+}
+
+}
+
+void traceStart(unsigned long spansPerThread) {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    if (buffers.empty()) {
+        // Buffers are sized on first use, so the size is fixed once a span is recorded
+        capacity = 1;
+        while (capacity < spansPerThread) {
+            capacity <<= 1;
+        }
+    }
+    if (!traceOrigin) {
+        traceOrigin = traceNowNs();
+    }
+    traceEnabled = true;
+}
+
+void traceSetThreadName(const char *name) {
+    threadName = name;
+    if (threadBuffer) {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        threadBuffer->threadName = name;
+    }
+}
+
+void traceRecord(const char *name, uint64_t start, uint64_t end) {
+    if (!threadBuffer) {
+        threadBuffer = registerThread();
+    }
+    uint64_t index = threadBuffer->written.load(std::memory_order_relaxed);
+    threadBuffer->records[index & (capacity - 1)] = {name, start, end};
+    threadBuffer->written.store(index + 1, std::memory_order_release);
+}
+
+bool traceWrite(const std::string &path) {
+    std::string temporary = path + ".tmp";
+    std::FILE *file = std::fopen(temporary.c_str(), "w");
+    if (!file) {
+        std::cerr << "Cannot write trace to " << temporary << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    std::fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    std::fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"cscreenkey\"}}");
+
+    std::vector<TraceRecord> copy;
+    for (TraceBuffer *buffer : buffers) {
+        if (buffer->threadName) {
+            std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                         buffer->tid);
+            writeJsonString(file, buffer->threadName);
+            std::fprintf(file, "}}");
+        }
+
+        // The owning thread keeps recording, so copy first and then drop
+        // whatever it may have overwritten during the copy
+        uint64_t end = buffer->written.load(std::memory_order_acquire);
+        uint64_t begin = end > capacity ? end - capacity : 0;
+        copy.clear();
+        for (uint64_t i = begin; i < end; i++) {
+            copy.push_back(buffer->records[i & (capacity - 1)]);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = buffer->written.load(std::memory_order_relaxed);
+        uint64_t valid = after > capacity ? after - capacity : 0;
+
+        for (uint64_t i = begin > valid ? begin : valid; i < end; i++) {
+            const TraceRecord &record = copy[i - begin];
+            std::fprintf(file, ",\n{\"name\":");
+            writeJsonString(file, record.name);
+            std::fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                         buffer->tid, (record.start - traceOrigin) / 1000.0,
+                         (record.end - record.start) / 1000.0);
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+
+    bool ok = std::fclose(file) == 0;
+    return ok && std::rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Span tracing of the capture -> render pipeline. CSK_TRACE_SCOPE("stage")
+// records how long the enclosing block took into a buffer owned by the calling
+// thread, so recording never takes a lock. traceWrite() saves the newest spans
+// of every thread as Chrome trace JSON, which chrome://tracing and
+// ui.perfetto.dev open directly.
+//
+// Tracing is off until traceStart() is called; a disabled span costs one
+// branch on traceEnabled.
+
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+extern bool traceEnabled;
+
+inline uint64_t traceNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Appends a finished span to the calling thread's buffer
+void traceRecord(const char *name, uint64_t start, uint64_t end);
+
+// Names the calling thread in the trace
+void traceSetThreadName(const char *name);
+
+// Enables recording; each thread keeps its newest `spansPerThread` spans.
+// Call it again to resume after traceEnabled was cleared.
+void traceStart(unsigned long spansPerThread = 65536);
+
+// Writes every recorded span as Chrome trace JSON; safe while threads keep recording
+bool traceWrite(const std::string &path);
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *spanName) {
+        if (traceEnabled) {
+            name = spanName;
+            start = traceNowNs();
+        }
+    }
+
+    ~TraceSpan() {
+        if (name) {
+            traceRecord(name, start, traceNowNs());
+        }
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name = nullptr;  // Must be a string literal, only the pointer is kept
+    uint64_t start = 0;
+};
+
+#define CSK_TRACE_CONCAT2(a, b) a##b
+#define CSK_TRACE_CONCAT(a, b) CSK_TRACE_CONCAT2(a, b)
+#define CSK_TRACE_SCOPE(name) TraceSpan CSK_TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#endif